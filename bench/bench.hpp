@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+Minimal benchmark harness. Each BENCH(name) body is registered at static
+init time and run by bench_main.cpp (optionally filtered by name), which
+also counts heap allocations and can write every result as JSON. */
+namespace bench
+{
+    struct Case
+    {
+        const char *name;
+        void (*fn)();
+    };
+
+    std::vector<Case> &registry();
+
+    struct Registrar
+    {
+        Registrar(const char *name, void (*fn)()) { registry().push_back({name, fn}); }
+    };
+
+    // operator new calls so far, on any thread
+    std::uint64_t allocations();
+
+    // Print and record one result; allocsPerOp < 0 means not measured
+    void report(const std::string &label, double nsPerOp, double opsPerSec, double allocsPerOp = -1);
+
+    // Time `iters` calls of fn and report ns/op and allocations/op
+    template <class F>
+    double run(const std::string &label, std::size_t iters, F &&fn)
+    {
+        std::uint64_t allocsBefore = allocations();
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iters; ++i)
+            fn(i);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        std::uint64_t allocs = allocations() - allocsBefore;
+
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        double nsPerOp = ns / static_cast<double>(iters);
+        report(label, nsPerOp, 1e9 / nsPerOp, static_cast<double>(allocs) / static_cast<double>(iters));
+        return nsPerOp;
+    }
+
+    // Keep the optimizer from discarding a computed value
+    template <class T>
+    inline void do_not_optimize(const T &value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+}
+
+#define BENCH(name)                                           \
+    static void name();                                       \
+    static bench::Registrar name##_registrar(#name, name);    \
+    static void name()
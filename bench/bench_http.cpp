@@ -0,0 +1,225 @@
+#include "bench.hpp"
+#include "../include/http.hpp"
+#include "../include/websockets.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+/*
+Request-head parsing: the resumable HttpParser against the previous path,
+which copied the receive buffer into a std::string, re-parsed it through
+std::istringstream and re-scanned every header in is_websocket_upgrade
+(both kept verbatim below as the baseline). */
+
+namespace legacy
+{
+    struct HttpRequest {
+        std::string method;
+        std::string path;   // path without query
+        std::string query;  // query string (after ?)
+        int versionMinor = 1;           // HTTP/1.x
+        std::size_t contentLength = 0;  // request body bytes following the head
+        bool keepAlive = false;         // connection persists after the response
+    };
+
+    bool parse_http_request(const std::string &raw, HttpRequest &out)
+    {
+        std::size_t lineEnd = raw.find("\r\n");
+        if (lineEnd == std::string::npos)
+            return false;
+        std::string firstLine = raw.substr(0, lineEnd);
+
+        std::istringstream iss(firstLine);
+        std::string method, uri, version;
+        if (!(iss >> method >> uri >> version))
+            return false;
+        if (version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0)
+            return false;
+
+        out.method = method;
+        out.versionMinor = version[7] - '0';
+
+        std::size_t qPos = uri.find("?");
+        if (qPos == std::string::npos)
+        {
+            out.path = uri;
+            out.query = "";
+        }
+        else
+        {
+            out.path = uri.substr(0, qPos);
+            out.query = uri.substr(qPos + 1);
+        }
+
+        // HTTP/1.1 persists by default, HTTP/1.0 only when asked to
+        bool closeRequested = false;
+        bool keepAliveRequested = false;
+        out.contentLength = 0;
+
+        std::size_t pos = lineEnd + 2;
+        while (pos < raw.size())
+        {
+            std::size_t end = raw.find("\r\n", pos);
+            if (end == std::string::npos || end == pos)
+                break;
+            std::string line = raw.substr(pos, end - pos);
+            pos = end + 2;
+
+            std::size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            std::string name = line.substr(0, colon);
+            std::string value = line.substr(colon + 1);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+            if (name == "connection")
+            {
+                closeRequested = value.find("close") != std::string::npos;
+                keepAliveRequested = value.find("keep-alive") != std::string::npos;
+            }
+            else if (name == "content-length")
+            {
+                out.contentLength = std::strtoul(value.c_str(), nullptr, 10);
+            }
+        }
+
+        out.keepAlive = out.versionMinor >= 1 ? !closeRequested : keepAliveRequested;
+        return true;
+    }
+
+    bool is_websocket_upgrade(const std::string &raw, std::string &secKeyOut)
+    {
+        std::istringstream iss(raw);
+        std::string line;
+
+        bool hasUpgrade = false;
+        bool hasConnection = false;
+        std::string secKey;
+
+        // skip request line, start from headers
+        std::getline(iss, line);
+
+        while (std::getline(iss, line))
+        {
+            if (line == "\r" || line.empty())
+                break;
+
+            auto pos = line.find(':');
+            if (pos == std::string::npos)
+                continue;
+            std::string name = line.substr(0, pos);
+            std::string value = line.substr(pos + 1);
+            // trim
+            auto trim = [](std::string &s)
+            {
+                while (!s.empty() && (s.back() == '\r' || s.back() == '\n' || s.back() == ' ' || s.back() == '\t'))
+                    s.pop_back();
+                size_t i = 0;
+                while (i < s.size() && (s[i] == ' ' || s[i] == '\t'))
+                    ++i;
+                s.erase(0, i);
+            };
+            trim(name);
+            trim(value);
+
+            std::string lowerName = name;
+            std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+
+            if (lowerName == "upgrade" && value.find("websocket") != std::string::npos)
+            {
+                hasUpgrade = true;
+            }
+            if (lowerName == "connection" && value.find("Upgrade") != std::string::npos)
+            {
+                hasConnection = true;
+            }
+            if (lowerName == "sec-websocket-key")
+            {
+                secKey = value;
+            }
+        }
+
+        if (hasUpgrade && hasConnection && !secKey.empty())
+        {
+            secKeyOut = secKey;
+            return true;
+        }
+        return false;
+    }
+}
+
+static const char ACTION_REQUEST[] =
+    "GET /match/action?id=K3J9QZ&team=0&action=ban&map=4&token=f8Hq2LmZpR7sT1vW9xYb3cDe HTTP/1.1\r\n"
+    "Host: veto.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36\r\n"
+    "Accept: application/json\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Origin: https://veto.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const char UPGRADE_REQUEST[] =
+    "GET /ws HTTP/1.1\r\n"
+    "Host: veto.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+BENCH(http_parse)
+{
+    const std::size_t iters = 500000;
+
+    bench::run("legacy parse_http_request", iters, [](std::size_t)
+               {
+        char buffer[4096];
+        std::size_t n = sizeof(ACTION_REQUEST) - 1;
+        std::copy(ACTION_REQUEST, ACTION_REQUEST + n, buffer);
+        buffer[n] = '\0';
+        std::string raw(buffer);
+        legacy::HttpRequest req;
+        legacy::parse_http_request(raw, req);
+        bench::do_not_optimize(req); });
+
+    bench::run("HttpParser", iters, [](std::size_t)
+               {
+        HttpParser parser;
+        HttpRequest req;
+        bench::do_not_optimize(parser.parse(ACTION_REQUEST, req));
+        bench::do_not_optimize(req); });
+
+    bench::run("legacy parse + is_websocket_upgrade", iters, [](std::size_t)
+               {
+        std::string raw(UPGRADE_REQUEST);
+        legacy::HttpRequest req;
+        legacy::parse_http_request(raw, req);
+        std::string key;
+        bench::do_not_optimize(legacy::is_websocket_upgrade(raw, key));
+        bench::do_not_optimize(key); });
+
+    bench::run("HttpParser + is_websocket_upgrade", iters, [](std::size_t)
+               {
+        HttpParser parser;
+        HttpRequest req;
+        parser.parse(UPGRADE_REQUEST, req);
+        bench::do_not_optimize(is_websocket_upgrade(req)); });
+
+    // the head arrives in 64-byte reads; the parser resumes instead of rescanning
+    bench::run("HttpParser, 64-byte partial reads", iters / 4, [](std::size_t)
+               {
+        std::string_view full(ACTION_REQUEST);
+        HttpParser parser;
+        HttpRequest req;
+        for (std::size_t len = 64;; len += 64) {
+            if (parser.parse(full.substr(0, std::min(len, full.size())), req) != HttpParseStatus::Incomplete)
+                break;
+        }
+        bench::do_not_optimize(req); });
+
+    bench::run("compute_websocket_accept", iters / 4, [](std::size_t)
+               { bench::do_not_optimize(compute_websocket_accept("dGhlIHNhbXBsZSBub25jZQ==")); });
+}
@@ -0,0 +1,94 @@
+#include "bench.hpp"
+#include "../include/journal.hpp"
+#include "../include/match.hpp"
+#include "../include/snapshot.hpp"
+
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+
+/*
+Restart cost: journal 100k matches (creation, both captain claims and the
+first three actions of a bo3), then time rebuilding the store the way
+open_journal does on startup: first by replaying the raw segments, then
+from a snapshot, where startup only maps the file and matches are
+materialized on first access or by the warmer. */
+
+static const std::size_t MATCH_COUNT = 100000;
+
+static void remove_dir(const std::string &dir)
+{
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name != "." && name != "..")
+                unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+BENCH(journal_replay)
+{
+    char dirTemplate[] = "/tmp/map_veto_journal_XXXXXX";
+    if (!mkdtemp(dirTemplate))
+        return;
+    std::string dir = dirTemplate;
+    std::string error;
+
+    pb::init_state();
+    if (!pb::open_journal(dir, error))
+    {
+        std::printf("  open_journal: %s\n", error.c_str());
+        return;
+    }
+
+    std::vector<std::string> ids;
+    ids.reserve(MATCH_COUNT);
+    bench::run("journal match + claims + 3 actions", MATCH_COUNT, [&](std::size_t)
+               {
+        pb::MatchHandle m = pb::create_match("Alpha", "Beta", "bo3");
+        for (int team = 0; team < 2; ++team) {
+            m->teamCaptainTokens[team] = "captain-token-" + std::to_string(team);
+            pb::journal_claim(*m, team);
+        }
+        perform_action(*m, pb::TEAM_A, pb::ActionType::Ban, 1);
+        perform_action(*m, pb::TEAM_B, pb::ActionType::Ban, 2);
+        perform_action(*m, pb::TEAM_A, pb::ActionType::Pick, 3);
+        ids.push_back(m->id); });
+    pb::close_journal();
+
+    pb::JournalReplayStats stats;
+    bench::run("replay_journal (100k matches, segments)", 3, [&](std::size_t)
+               {
+        pb::init_state();
+        pb::replay_journal(dir, stats, error); });
+    std::printf("  replayed %zu records\n", stats.records);
+
+    pb::init_state();
+    pb::open_journal(dir, error);
+    bench::run("compact_journal (snapshot 100k matches)", 1, [&](std::size_t)
+               { pb::compact_journal(); });
+    pb::close_journal();
+
+    pb::init_state();
+    bench::run("replay_journal (100k matches, snapshot)", 3, [&](std::size_t)
+               {
+        pb::discard_snapshot();
+        pb::replay_journal(dir, stats, error); });
+    std::printf("  mapped %zu snapshot matches, replayed %zu records\n", stats.snapshotMatches, stats.records);
+
+    bench::run("get_match, first access after restart", ids.size(), [&](std::size_t i)
+               { bench::do_not_optimize(pb::get_match(ids[i])); });
+
+    pb::init_state();
+    pb::replay_journal(dir, stats, error);
+    bench::run("warm_snapshot (100k matches)", 1, [&](std::size_t)
+               { pb::warm_snapshot(); });
+
+    pb::init_state();
+    remove_dir(dir);
+}
@@ -0,0 +1,207 @@
+#include "bench.hpp"
+#include "../include/state.hpp"
+#include "../include/veto_format.hpp"
+
+#include <sstream>
+
+/*
+match_to_json / match_to_light_json against the ostringstream serializer
+they replaced (kept verbatim below as the baseline). */
+
+namespace legacy
+{
+    using namespace pb;
+
+    std::string match_to_json(const Match &m)
+    {
+        std::ostringstream oss;
+        oss << "{";
+        oss << "\"id\":\"" << m.id << "\",";
+        oss << "\"version\":" << m.version << ",";
+        oss << "\"phase\":" << static_cast<int>(m.phase) << ",";
+        oss << "\"currentTurnTeam\":" << m.currentTurnTeam << ",";
+        oss << "\"currentStepIndex\":" << m.currentStepIndex << ",";
+        oss << "\"deciderMapId\":" << m.deciderMapId << ",";
+        std::string seriesType = m.format->name;
+        oss << "\"seriesType\":\"" << seriesType << "\",";
+        oss << "\"captainTaken\":["
+            << (m.teamCaptainTokens[0].empty() ? false : true) << ","
+            << (m.teamCaptainTokens[1].empty() ? false : true) << "],";
+        oss << "\"deciderSide\":" << m.deciderSide << ",";
+        oss << "\"deciderSidePickerTeam\":" << m.deciderSidePickerTeam << ",";
+        oss << "\"teams\":[";
+        for (int i = 0; i < 2; ++i)
+        {
+            const Team &team = m.teams[i];
+            oss << "{";
+            oss << "\"name\":\"" << team.name << "\",";
+
+            oss << "\"bannedMapIds\":[";
+            for (size_t j = 0; j < team.bannedMapIds.size(); ++j)
+            {
+                oss << team.bannedMapIds[j];
+                if (j + 1 < team.bannedMapIds.size())
+                    oss << ",";
+            }
+            oss << "],";
+
+            oss << "\"pickedMapIds\":[";
+            for (size_t j = 0; j < team.pickedMapIds.size(); ++j)
+            {
+                oss << team.pickedMapIds[j];
+                if (j + 1 < team.pickedMapIds.size())
+                    oss << ",";
+            }
+            oss << "]";
+
+            oss << "}";
+            if (i + 1 < 2)
+                oss << ",";
+        }
+        oss << "],";
+        oss << "\"availableMaps\":[";
+        for (size_t i = 0; i < m.catalog->maps.size(); ++i)
+        {
+            const Map &map = m.catalog->maps[i];
+            oss << "{";
+            oss << "\"id\":" << map.id << ",";
+            oss << "\"name\":\"" << map.name << "\",";
+            oss << "\"previewUrl\":\"" << map.previewUrl << "\",";
+            oss << "\"mapImgUrl\":\"" << map.mapImgUrl << "\"";
+            oss << "}";
+            if (i + 1 < m.catalog->maps.size())
+                oss << ",";
+        }
+
+        oss << "],";
+        oss << "\"stepMapIds\":[";
+        for (size_t i = 0; i < m.stepMapIds.size(); ++i)
+        {
+            oss << m.stepMapIds[i];
+            if (i + 1 < m.stepMapIds.size())
+                oss << ",";
+        }
+        oss << "],";
+
+        oss << "\"stepSideVals\":[";
+        for (size_t i = 0; i < m.stepSideVals.size(); ++i)
+        {
+            oss << m.stepSideVals[i];
+            if (i + 1 < m.stepSideVals.size())
+                oss << ",";
+        }
+        oss << "],";
+        oss << "\"steps\":[";
+        for (size_t i = 0; i < m.format->steps.size(); ++i)
+        {
+            oss << "{";
+            oss << "\"action\":" << static_cast<int>(m.format->steps[i].action) << ",";
+            oss << "\"teamIndex\":" << m.format->steps[i].teamIndex;
+            oss << "}";
+            if (i + 1 < m.format->steps.size())
+                oss << ",";
+        }
+        oss << "]";
+        oss << "}";
+        return oss.str();
+    }
+    std::string match_to_light_json(const Match &m)
+{
+    std::ostringstream oss;
+    oss << "{";
+    oss << "\"id\":\"" << m.id << "\",";
+    oss << "\"version\":" << m.version << ",";
+    oss << "\"phase\":" << static_cast<int>(m.phase) << ",";
+    oss << "\"currentTurnTeam\":" << m.currentTurnTeam << ",";
+    oss << "\"currentStepIndex\":" << m.currentStepIndex << ",";
+    oss << "\"deciderMapId\":" << m.deciderMapId << ",";
+    
+    oss << "\"deciderSide\":" << m.deciderSide << ",";
+    oss << "\"deciderSidePickerTeam\":" << m.deciderSidePickerTeam << ",";
+
+    oss << "\"captainTaken\":["
+        << (m.teamCaptainTokens[0].empty() ? false : true) << ","
+        << (m.teamCaptainTokens[1].empty() ? false : true) << "],";
+
+    oss << "\"teams\":[";
+    for (int i = 0; i < 2; ++i)
+    {
+        const Team &team = m.teams[i];
+        oss << "{";
+
+        oss << "\"bannedMapIds\":[";
+        for (size_t j = 0; j < team.bannedMapIds.size(); ++j)
+        {
+            oss << team.bannedMapIds[j];
+            if (j + 1 < team.bannedMapIds.size()) oss << ",";
+        }
+        oss << "],";
+
+        oss << "\"pickedMapIds\":[";
+        for (size_t j = 0; j < team.pickedMapIds.size(); ++j)
+        {
+            oss << team.pickedMapIds[j];
+            if (j + 1 < team.pickedMapIds.size()) oss << ",";
+        }
+        oss << "]";
+        oss << "}";
+        if (i + 1 < 2) oss << ",";
+    }
+    oss << "],";
+
+    oss << "\"stepMapIds\":[";
+    for (size_t i = 0; i < m.stepMapIds.size(); ++i)
+    {
+        oss << m.stepMapIds[i];
+        if (i + 1 < m.stepMapIds.size()) oss << ",";
+    }
+    oss << "],";
+
+    oss << "\"stepSideVals\":[";
+    for (size_t i = 0; i < m.stepSideVals.size(); ++i)
+    {
+        oss << m.stepSideVals[i];
+        if (i + 1 < m.stepSideVals.size()) oss << ",";
+    }
+    oss << "]"; 
+
+    oss << "}";
+    return oss.str();
+}
+
+}
+
+// A bo3 match halfway through its veto
+static pb::MatchHandle make_bench_match()
+{
+    pb::MatchHandle m = pb::create_match("Sentinels", "Fnatic", "bo3");
+    m->teamCaptainTokens[pb::TEAM_A] = "captainA";
+    pb::apply_action(*m, pb::TEAM_A, pb::ActionType::Ban, 1);
+    pb::apply_action(*m, pb::TEAM_B, pb::ActionType::Ban, 2);
+    pb::apply_action(*m, pb::TEAM_A, pb::ActionType::Pick, 3);
+    pb::apply_action(*m, pb::TEAM_B, pb::ActionType::Side, 1);
+    return m;
+}
+
+BENCH(json_serialize)
+{
+    pb::init_state();
+    pb::MatchHandle m = make_bench_match();
+    const std::size_t iters = 200000;
+
+    bench::run("legacy match_to_json", iters, [&](std::size_t)
+               { bench::do_not_optimize(legacy::match_to_json(*m)); });
+    bench::run("match_to_json", iters, [&](std::size_t)
+               { bench::do_not_optimize(pb::match_to_json(*m)); });
+    bench::run("legacy match_to_light_json", iters, [&](std::size_t)
+               { bench::do_not_optimize(legacy::match_to_light_json(*m)); });
+    bench::run("match_to_light_json", iters, [&](std::size_t)
+               { bench::do_not_optimize(pb::match_to_light_json(*m)); });
+
+    std::string buf;
+    bench::run("append_match_json (reused buffer)", iters, [&](std::size_t)
+               {
+        buf.clear();
+        pb::append_match_json(*m, buf);
+        bench::do_not_optimize(buf); });
+}
@@ -0,0 +1,150 @@
+#include "bench.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Every heap allocation in the process goes through here and is counted
+static std::atomic<std::uint64_t> g_allocations{0};
+
+void *operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace bench
+{
+    struct Result
+    {
+        std::string bench;
+        std::string label;
+        double nsPerOp;
+        double opsPerSec;
+        double allocsPerOp;
+    };
+
+    static std::vector<Result> g_results;
+    static const char *g_currentBench = "";
+
+    std::vector<Case> &registry()
+    {
+        static std::vector<Case> cases;
+        return cases;
+    }
+
+    std::uint64_t allocations()
+    {
+        return g_allocations.load(std::memory_order_relaxed);
+    }
+
+    void report(const std::string &label, double nsPerOp, double opsPerSec, double allocsPerOp)
+    {
+        if (allocsPerOp < 0)
+            std::printf("  %-44s %12.1f ns/op %14.0f ops/s\n", label.c_str(), nsPerOp, opsPerSec);
+        else
+            std::printf("  %-44s %12.1f ns/op %14.0f ops/s %10.2f allocs/op\n",
+                        label.c_str(), nsPerOp, opsPerSec, allocsPerOp);
+        g_results.push_back(Result{g_currentBench, label, nsPerOp, opsPerSec, allocsPerOp});
+    }
+
+    static void write_json_string(std::FILE *f, const std::string &s)
+    {
+        std::fputc('"', f);
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                std::fputc('\\', f);
+            std::fputc(c, f);
+        }
+        std::fputc('"', f);
+    }
+
+    // One object per result, so runs can be diffed or loaded by a script
+    static bool write_results(const char *path)
+    {
+        std::FILE *f = std::fopen(path, "w");
+        if (!f)
+            return false;
+        std::fprintf(f, "[\n");
+        for (std::size_t i = 0; i < g_results.size(); ++i)
+        {
+            const Result &r = g_results[i];
+            std::fprintf(f, "  {\"bench\":");
+            write_json_string(f, r.bench);
+            std::fprintf(f, ",\"label\":");
+            write_json_string(f, r.label);
+            std::fprintf(f, ",\"ns_per_op\":%.3f,\"ops_per_sec\":%.1f", r.nsPerOp, r.opsPerSec);
+            if (r.allocsPerOp >= 0)
+                std::fprintf(f, ",\"allocs_per_op\":%.3f", r.allocsPerOp);
+            std::fprintf(f, "}%s\n", i + 1 < g_results.size() ? "," : "");
+        }
+        std::fprintf(f, "]\n");
+        return std::fclose(f) == 0;
+    }
+}
+
+// Usage: map_veto_bench [--json results.json] [name-substring...]
+int main(int argc, char **argv)
+{
+    const char *jsonPath = nullptr;
+    std::vector<const char *> filters;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else
+            filters.push_back(argv[i]);
+    }
+
+    for (const auto &c : bench::registry())
+    {
+        bool selected = filters.empty();
+        for (const char *filter : filters)
+        {
+            if (std::strstr(c.name, filter))
+                selected = true;
+        }
+        if (!selected)
+            continue;
+
+        std::printf("%s\n", c.name);
+        bench::g_currentBench = c.name;
+        c.fn();
+    }
+
+    if (jsonPath && !bench::write_results(jsonPath))
+    {
+        std::fprintf(stderr, "could not write %s\n", jsonPath);
+        return 1;
+    }
+    return 0;
+}
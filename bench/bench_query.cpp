@@ -0,0 +1,119 @@
+#include "bench.hpp"
+#include "../include/http.hpp"
+
+#include <sstream>
+#include <string>
+
+/*
+Query-string handling for a /match/action request: one QueryParams pass
+against the previous per-key rescans, which ran url_decode (one
+istringstream per escape) and std::stoi on every lookup (kept verbatim
+below as the baseline). */
+
+namespace legacy
+{
+    std::string url_decode(std::string_view s)
+    {
+        std::string out;
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i] == '%' && i + 2 < s.size())
+            {
+                int v = 0;
+                std::istringstream iss(std::string(s.substr(i + 1, 2)));
+                iss >> std::hex >> v;
+                out.push_back(static_cast<char>(v));
+                i += 2;
+            }
+            else if (s[i] == '+')
+            {
+                out.push_back(' ');
+            }
+            else
+            {
+                out.push_back(s[i]);
+            }
+        }
+        return out;
+    }
+
+    std::string get_query_param(std::string_view query, std::string_view key)
+    {
+        std::string pattern = std::string(key) + "=";
+        std::size_t pos = query.find(pattern);
+        if (pos == std::string_view::npos)
+            return "";
+        pos += pattern.size();
+        std::size_t end = query.find("&", pos);
+        std::string_view val = query.substr(
+            pos,
+            end == std::string_view::npos ? std::string_view::npos : end - pos);
+        return url_decode(val);
+    }
+}
+
+static const std::string_view ACTION_QUERY =
+    "id=K3J9QZ&team=0&action=ban&map=4&token=f8Hq2LmZpR7sT1vW9xYb3cDe";
+static const std::string_view CREATE_QUERY =
+    "teamA=Team%20Liquid&teamB=Paper%20Rex%20%28PRX%29&series=bo3";
+
+BENCH(query_params)
+{
+    const std::size_t iters = 500000;
+
+    bench::run("legacy get_query_param x5 + stoi", iters, [](std::size_t)
+               {
+        std::string id = legacy::get_query_param(ACTION_QUERY, "id");
+        int team = std::stoi(legacy::get_query_param(ACTION_QUERY, "team"));
+        std::string action = legacy::get_query_param(ACTION_QUERY, "action");
+        int map = std::stoi(legacy::get_query_param(ACTION_QUERY, "map"));
+        std::string token = legacy::get_query_param(ACTION_QUERY, "token");
+        bench::do_not_optimize(id); bench::do_not_optimize(team); bench::do_not_optimize(action);
+        bench::do_not_optimize(map); bench::do_not_optimize(token); });
+
+    bench::run("QueryParams action", iters, [](std::size_t)
+               {
+        QueryParams params(ACTION_QUERY);
+        std::string id = params.get("id");
+        int team = 0, map = 0;
+        bool ok = params.get_int("team", team) && params.get_int("map", map);
+        std::string_view action;
+        params.find("action", action);
+        std::string token = params.get("token");
+        bench::do_not_optimize(id); bench::do_not_optimize(ok); bench::do_not_optimize(action);
+        bench::do_not_optimize(token); });
+
+    bench::run("legacy create (escaped names)", iters, [](std::size_t)
+               {
+        std::string a = legacy::get_query_param(CREATE_QUERY, "teamA");
+        std::string b = legacy::get_query_param(CREATE_QUERY, "teamB");
+        std::string s = legacy::get_query_param(CREATE_QUERY, "series");
+        bench::do_not_optimize(a); bench::do_not_optimize(b); bench::do_not_optimize(s); });
+
+    bench::run("QueryParams create (escaped names)", iters, [](std::size_t)
+               {
+        QueryParams params(CREATE_QUERY);
+        std::string a = params.get("teamA");
+        std::string b = params.get("teamB");
+        std::string s = params.get("series");
+        bench::do_not_optimize(a); bench::do_not_optimize(b); bench::do_not_optimize(s); });
+
+    // malformed spam: previously std::stoi threw and unwound
+    bench::run("legacy malformed team (exception)", iters, [](std::size_t)
+               {
+        int team = -1;
+        try { team = std::stoi(legacy::get_query_param("id=K3J9QZ&team=x&map=4", "team")); }
+        catch (...) { team = -1; }
+        bench::do_not_optimize(team); });
+
+    bench::run("QueryParams malformed team", iters, [](std::size_t)
+               {
+        QueryParams params("id=K3J9QZ&team=x&map=4");
+        int team = -1;
+        bench::do_not_optimize(params.get_int("team", team)); });
+
+    bench::run("get_query_param token", iters, [](std::size_t)
+               { bench::do_not_optimize(get_query_param(ACTION_QUERY, "token")); });
+    bench::run("url_decode (escaped team name)", iters, [](std::size_t)
+               { bench::do_not_optimize(url_decode("Paper%20Rex%20%28PRX%29")); });
+}
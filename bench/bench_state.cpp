@@ -0,0 +1,72 @@
+#include "bench.hpp"
+#include "../include/state.hpp"
+#include "../include/veto_format.hpp"
+
+#include <vector>
+
+/*
+apply_action over whole vetoes: every step of a bo1 and a bo3, starting
+each iteration from a copy of a fresh match. The copy alone is timed too,
+so the cost of the actions is the difference. */
+
+struct BenchAction
+{
+    int team;
+    pb::ActionType action;
+    int value;
+};
+
+// A legal action for every step, found by playing the first value each step accepts
+static std::vector<BenchAction> veto_sequence(const pb::Match &fresh)
+{
+    std::vector<BenchAction> out;
+    pb::Match m = fresh;
+    while (m.currentStepIndex < m.format->steps.size())
+    {
+        const std::size_t stepIdx = m.currentStepIndex;
+        const pb::Step &step = m.format->steps[stepIdx];
+        for (int value = 0; value < 64; ++value)
+        {
+            if (pb::apply_action(m, step.teamIndex, step.action, value))
+            {
+                out.push_back(BenchAction{step.teamIndex, step.action, value});
+                break;
+            }
+        }
+        if (m.currentStepIndex == stepIdx)
+            break;
+    }
+    return out;
+}
+
+BENCH(apply_action)
+{
+    pb::init_state();
+    const std::size_t iters = 200000;
+
+    for (const char *series : {"bo1", "bo3"})
+    {
+        const pb::Match fresh = *pb::create_match("Sentinels", "Fnatic", series);
+        const std::vector<BenchAction> actions = veto_sequence(fresh);
+        const std::string label = std::string(series) + " (" + std::to_string(actions.size()) + " steps)";
+
+        bench::run("Match copy, " + label, iters, [&](std::size_t)
+                   {
+            pb::Match m = fresh;
+            bench::do_not_optimize(m); });
+
+        bench::run("Match copy + full veto, " + label, iters, [&](std::size_t)
+                   {
+            pb::Match m = fresh;
+            for (const BenchAction &a : actions)
+                pb::apply_action(m, a.team, a.action, a.value);
+            bench::do_not_optimize(m); });
+
+        // a rejected action (wrong team) is the common spam case
+        bench::run("rejected action, " + label, iters, [&](std::size_t)
+                   {
+            pb::Match m = fresh;
+            bench::do_not_optimize(pb::apply_action(m, 1 - actions[0].team, actions[0].action, actions[0].value)); });
+    }
+    pb::init_state();
+}
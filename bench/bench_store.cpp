@@ -0,0 +1,86 @@
+#include "bench.hpp"
+#include "../include/state.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/*
+Store contention: every thread repeatedly locks a random match and renders
+it, once through the sharded store and once behind a single global mutex
+(what every endpoint used to take). Aggregate throughput should scale with
+threads for the sharded store and flatten for the global one. Single
+threaded, it also times the id lookup alone and creating a match into a
+recycled slot. */
+
+static const std::size_t MATCH_COUNT = 4096;
+static const std::size_t OPS_PER_THREAD = 100000;
+
+static double run_threads(unsigned threads, const std::vector<std::string> &ids, std::mutex *global)
+{
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+                             {
+            uint32_t x = 2463534242u + t * 7919u;
+            while (!go.load()) {
+            }
+            for (std::size_t i = 0; i < OPS_PER_THREAD; ++i) {
+                x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+                const std::string &id = ids[x % ids.size()];
+
+                std::unique_lock<std::mutex> outer;
+                if (global)
+                    outer = std::unique_lock<std::mutex>(*global);
+                pb::MatchHandle m = pb::get_match(id);
+                bench::do_not_optimize(pb::match_to_light_json(*m));
+            } });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto &w : workers)
+        w.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+BENCH(store_contention)
+{
+    pb::init_state();
+    std::vector<std::string> ids;
+    for (std::size_t i = 0; i < MATCH_COUNT; ++i)
+        ids.push_back(pb::create_match("Alpha", "Beta", "bo3")->id);
+
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+
+    bench::run("get_match (4096 live)", ids.size() * 64, [&](std::size_t i)
+               { bench::do_not_optimize(pb::get_match(ids[i % ids.size()])); });
+    bench::run("create_match + erase_match", 100000, [&](std::size_t)
+               {
+        std::string id = pb::create_match("Alpha", "Beta", "bo3")->id;
+        pb::erase_match(id); });
+
+    std::mutex global;
+    run_threads(1, ids, nullptr); // warm caches and allocator
+    for (unsigned threads : counts)
+    {
+        for (bool sharded : {false, true})
+        {
+            double ns = run_threads(threads, ids, sharded ? nullptr : &global);
+            double ops = static_cast<double>(threads * OPS_PER_THREAD);
+            bench::report(std::string(sharded ? "sharded" : "global-mutex") + " threads=" +
+                              std::to_string(threads),
+                          ns / ops, ops * 1e9 / ns);
+        }
+    }
+    pb::init_state();
+}
@@ -0,0 +1,277 @@
+#include "bench.hpp"
+#include "../include/ws_frame.hpp"
+#include "../include/websockets.hpp"
+#include "../include/veto_format.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+Frame encoding and sending (ws_send): the previous writer sent the header
+and the payload with separate send() calls; Connection now queues both and
+writes them, plus anything else queued, with one sendmsg(). Measured over
+a socketpair that a second thread drains.
+
+Spectator egress (ws_deflate): the snapshot and every patch of a full bo3
+veto, sent plain and with permessage-deflate, and what compressing them
+costs. A broadcast compresses each patch once for all its subscribers.
+
+Client frame decoding (ws_decode): parse_ws_frame, which unmasks in place a word at a
+time, against the previous decoder that copied every payload out and
+unmasked byte by byte (kept verbatim below as the baseline). Each op
+decodes one frame from a buffer holding many back to back, as a single
+recv() delivers them. */
+
+namespace legacy
+{
+    enum class WsFrameStatus { Incomplete, Frame, Error };
+
+    WsFrameStatus parse_ws_frame(const char *data, std::size_t len,
+                                 std::size_t &consumed, uint8_t &opcode, std::string &outPayload)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+        if (len < 2)
+            return WsFrameStatus::Incomplete;
+
+        opcode = p[0] & 0x0F;
+        bool mask = (p[1] & 0x80) != 0;
+        uint64_t payloadLen = p[1] & 0x7F;
+        std::size_t pos = 2;
+
+        if (!mask)
+        {
+            // Client frames MUST be masked
+            return WsFrameStatus::Error;
+        }
+
+        if (payloadLen == 126)
+        {
+            if (len < pos + 2)
+                return WsFrameStatus::Incomplete;
+            payloadLen = (p[2] << 8) | p[3];
+            pos += 2;
+        }
+        else if (payloadLen == 127)
+        {
+            // skipping 64-bit payloads for brevity
+            return WsFrameStatus::Error;
+        }
+
+        if (len < pos + 4 + payloadLen)
+            return WsFrameStatus::Incomplete;
+
+        const uint8_t *maskKey = p + pos;
+        pos += 4;
+
+        outPayload.assign(data + pos, payloadLen);
+        for (uint64_t i = 0; i < payloadLen; ++i)
+        {
+            outPayload[i] ^= maskKey[i % 4];
+        }
+
+        consumed = pos + payloadLen;
+        return WsFrameStatus::Frame;
+    }
+}
+
+// count masked text frames of payloadSize bytes, back to back
+static std::string make_stream(std::size_t payloadSize, std::size_t count)
+{
+    std::string out;
+    for (std::size_t f = 0; f < count; ++f)
+    {
+        out.push_back(static_cast<char>(0x81));
+        if (payloadSize < 126)
+        {
+            out.push_back(static_cast<char>(0x80 | payloadSize));
+        }
+        else
+        {
+            out.push_back(static_cast<char>(0x80 | 126));
+            out.push_back(static_cast<char>(payloadSize >> 8));
+            out.push_back(static_cast<char>(payloadSize & 0xFF));
+        }
+        const char key[4] = {0x12, 0x34, 0x56, 0x78};
+        out.append(key, 4);
+        for (std::size_t i = 0; i < payloadSize; ++i)
+            out.push_back(static_cast<char>('a' + i % 26) ^ key[i % 4]);
+    }
+    return out;
+}
+
+BENCH(ws_decode)
+{
+    const std::size_t sizes[] = {16, 256, 4096, 32768};
+    for (std::size_t size : sizes)
+    {
+        const std::size_t frames = 64;
+        const std::string stream = make_stream(size, frames);
+        const std::size_t iters = std::max<std::size_t>(2000, (1u << 26) / (size * frames)) * frames;
+        const std::string label = std::to_string(size) + "-byte frames";
+
+        std::string payload;
+        std::size_t offset = 0;
+        bench::run("legacy parse_ws_frame, " + label, iters, [&](std::size_t)
+                   {
+            if (offset == stream.size())
+                offset = 0;
+            std::size_t consumed = 0;
+            uint8_t opcode = 0;
+            legacy::parse_ws_frame(stream.data() + offset, stream.size() - offset, consumed, opcode, payload);
+            offset += consumed;
+            bench::do_not_optimize(payload); });
+
+        // decoding unmasks in place; later passes just re-apply the mask
+        std::string buf = stream;
+        offset = 0;
+        bench::run("parse_ws_frame, " + label, iters, [&](std::size_t)
+                   {
+            if (offset == buf.size())
+                offset = 0;
+            std::size_t consumed = 0;
+            WsFrame frame;
+            parse_ws_frame(&buf[offset], buf.size() - offset, consumed, frame);
+            offset += consumed;
+            bench::do_not_optimize(frame); });
+    }
+}
+
+BENCH(ws_encode)
+{
+    const std::size_t sizes[] = {200, 4096, 100000};
+    for (std::size_t size : sizes)
+    {
+        const std::string payload(size, 'x');
+        bench::run("make_ws_text_frame, " + std::to_string(size) + "-byte messages", 200000, [&](std::size_t)
+                   {
+            WsOutFrame frame = make_ws_text_frame(payload);
+            bench::do_not_optimize(frame); });
+    }
+}
+
+// Block until the socket has room, as the event loop would via EPOLLOUT
+static void wait_writable(int fd)
+{
+    pollfd p{fd, POLLOUT, 0};
+    poll(&p, 1, -1);
+}
+
+// Drain the far end of a socketpair until it closes; returns bytes read
+static std::thread start_drain(int fd, std::size_t &total)
+{
+    return std::thread([fd, &total]()
+                       {
+        char buf[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            total += static_cast<std::size_t>(n); });
+}
+
+static std::size_t frame_header_size(std::size_t payloadSize)
+{
+    return payloadSize <= 125 ? 2 : payloadSize < 65536 ? 4 : 10;
+}
+
+BENCH(ws_send)
+{
+    const std::size_t sizes[] = {200, 4096, 100000};
+    for (std::size_t size : sizes)
+    {
+        const std::size_t iters = size > 10000 ? 5000 : 100000;
+        const std::string payload(size, 'x');
+        const std::string label = std::to_string(size) + "-byte messages";
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+            return;
+        std::size_t drained = 0;
+        std::thread drain = start_drain(sv[1], drained);
+
+        // legacy: header, then body, each with its own blocking send()
+        bench::run("legacy send() x2, " + label, iters, [&](std::size_t)
+                   {
+            WsOutFrame frame = make_ws_text_frame(payload);
+            wait_writable(sv[0]);
+            ::send(sv[0], frame.header->data(), frame.header->size(), MSG_NOSIGNAL);
+            ::send(sv[0], frame.payload->data(), frame.payload->size(), MSG_NOSIGNAL); });
+
+        Connection conn(sv[0], nullptr);
+        bench::run("send_ws_text (sendmsg), " + label, iters, [&](std::size_t)
+                   {
+            wait_writable(sv[0]);
+            send_ws_text(conn, payload); });
+
+        shutdown(sv[0], SHUT_WR);
+        drain.join();
+        if (drained != 2 * iters * (payload.size() + frame_header_size(size)))
+            std::printf("  (only %zu bytes arrived)\n", drained);
+        close(sv[0]);
+        close(sv[1]);
+    }
+}
+
+// Messages a spectator receives over a whole veto: the snapshot, then one patch per step
+static std::vector<std::string> veto_messages(const std::string &series)
+{
+    std::vector<std::string> out;
+    pb::MatchHandle m = pb::create_match("Alpha", "Beta", series);
+    out.push_back(pb::match_to_json(*m));
+    while (m->currentStepIndex < m->format->steps.size())
+    {
+        const std::size_t stepIdx = m->currentStepIndex;
+        const pb::Step &step = m->format->steps[stepIdx];
+        // the first map (or side) the step accepts
+        for (int value = 0; value < 64 && m->currentStepIndex == stepIdx; ++value)
+            pb::apply_action(*m, step.teamIndex, step.action, value);
+        if (m->currentStepIndex == stepIdx)
+            break;
+        out.push_back(pb::match_to_patch_json(*m, stepIdx));
+    }
+    return out;
+}
+
+BENCH(ws_deflate)
+{
+    pb::init_state();
+    const std::vector<std::string> messages = veto_messages("bo3");
+
+    std::size_t plainBytes = 0;
+    std::size_t deflatedBytes = 0;
+    std::string out;
+    for (const std::string &msg : messages)
+    {
+        plainBytes += frame_header_size(msg.size()) + msg.size();
+        if (deflate_message(msg, out))
+            deflatedBytes += frame_header_size(out.size()) + out.size();
+        else
+            deflatedBytes += frame_header_size(msg.size()) + msg.size();
+    }
+    std::printf("  bo3 veto, %zu messages: %zu bytes plain, %zu deflated (%.0f%% saved)\n",
+                messages.size(), plainBytes, deflatedBytes,
+                100.0 * static_cast<double>(plainBytes - deflatedBytes) / static_cast<double>(plainBytes));
+
+    bench::run("deflate_message, bo3 snapshot", 20000, [&](std::size_t)
+               {
+        deflate_message(messages[0], out);
+        bench::do_not_optimize(out); });
+    bench::run("deflate_message, bo3 patch", 100000, [&](std::size_t i)
+               {
+        deflate_message(messages[1 + i % (messages.size() - 1)], out);
+        bench::do_not_optimize(out); });
+
+    WsInflater inflater(false);
+    std::string compressed;
+    deflate_message(messages[0], compressed);
+    bench::run("WsInflater, bo3 snapshot", 20000, [&](std::size_t)
+               {
+        inflater.inflate_message(compressed, out);
+        bench::do_not_optimize(out); });
+
+    pb::init_state();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "../include/http.hpp"
+#include "../include/ws_frame.hpp"
+#include "../include/ws_deflate.hpp"
+
+class EventLoop;
+
+// Immutable bytes shared by every connection they are queued on
+using SharedBuffer = std::shared_ptr<const std::string>;
+
+enum class ConnState
+{
+    Http,
+    WebSocket,
+    Closing // response queued, input is ignored until the socket closes
+};
+
+/*
+A non-blocking client socket owned by exactly one EventLoop.
+state, inbuf and matchId are only touched by the owning loop thread.
+The outgoing queue may be written from any thread (e.g. broadcasts). */
+struct Connection
+{
+    Connection(int fd, EventLoop *loop);
+
+    int fd;
+    EventLoop *loop;
+
+    ConnState state = ConnState::Http;
+    std::string inbuf;   // bytes received but not yet consumed
+    HttpParser parser;   // progress on the request at the front of inbuf
+    WsMessageAssembler wsMessages; // fragments of the message being received
+    bool wsDeflate = false;        // permessage-deflate negotiated; fixed before subscribing
+    WsDeflateParams wsDeflateParams;
+    std::unique_ptr<WsInflater> wsInflater; // created on the first compressed message
+    std::string matchId; // match a WebSocket client subscribed to
+    std::string pendingSubscription; // match to subscribe to once its owner loop has the socket
+    unsigned requestsServed = 0; // HTTP requests answered on this socket
+    bool awaitingRemote = false; // a request is being answered by another loop; input stays in the socket
+    bool readPaused = false;     // the loop stopped reading with input possibly left in the socket
+    std::size_t accountedInput = 0; // part of inbuf counted in the loop's bufferedInput
+
+    // Queue a buffer and write as much as the socket accepts right now
+    void send(SharedBuffer data);
+    void send(std::string data) { send(std::make_shared<const std::string>(std::move(data))); }
+    // Queue two buffers back to back (a frame header and its payload)
+    void send(SharedBuffer first, SharedBuffer second);
+
+    // Half-close the socket once everything queued so far is written
+    void close_after_flush();
+
+    // True while the client is not keeping up with its output (or has been cut off
+    // for it); no more requests are answered and input is left in the socket
+    bool output_backlogged();
+
+    // Ask the owning loop to tear the connection down (any thread)
+    void shutdown();
+
+private:
+    friend class EventLoop;
+
+    // Append to outQueue; false if the client is hopelessly behind. Requires outMutex.
+    bool enqueue_locked(SharedBuffer data);
+    // Write queued bytes until drained or EAGAIN, many buffers per syscall. Requires outMutex.
+    void flush_locked();
+
+    // idle tracking, owned by the loop thread; lastActive is the last inbound data
+    std::chrono::steady_clock::time_point lastActive;
+    std::list<Connection *>::iterator idleIt;
+    bool idleTracked = false;
+
+    // WebSocket heartbeat, owned by the loop thread
+    std::chrono::steady_clock::time_point pingSent;
+    bool pingOutstanding = false;
+    bool heartbeatScheduled = false;
+
+    std::mutex outMutex;
+    std::deque<SharedBuffer> outQueue;
+    std::size_t outOffset = 0; // bytes of outQueue.front() already written
+    std::size_t queuedBytes = 0;
+    bool overflowed = false; // enqueue_locked gave up on this client
+    bool closeAfterFlush = false;
+    bool closed = false;
+};
+
+using ConnectionPtr = std::shared_ptr<Connection>;
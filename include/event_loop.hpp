@@ -0,0 +1,133 @@
+#pragma once
+
+#include "../include/connection.hpp"
+#include "../include/timing_wheel.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// HTTP connections with no traffic for this long are closed
+const std::chrono::seconds HTTP_IDLE_TIMEOUT{10};
+
+/*
+WebSocket keepalive: a client silent for interval is pinged, and closed
+(which unsubscribes it) if nothing at all arrives within timeout of the
+ping. Any inbound frame counts as a sign of life. A zero interval turns
+heartbeats off. */
+struct WsHeartbeatConfig
+{
+    std::chrono::seconds interval{20};
+    std::chrono::seconds timeout{10};
+};
+
+// Order in which a loop runs request work queued by other loops
+enum class WorkPriority
+{
+    High, // captains' actions and claims
+    Low   // state polling and egress stats
+};
+
+/*
+Edge-triggered epoll reactor. Each loop runs on its own I/O thread, accepts
+on its own SO_REUSEPORT socket and owns the connections it accepted;
+readiness events drive the HTTP/WebSocket state machines in
+handle_client_connection.
+
+Every match is also owned by one loop (see owner_of). Requests naming a
+match are answered on its owner and WebSocket subscribers move there, so
+a match's state, its broadcasts and its subscribers' sockets are all
+handled by one thread and its shard lock is normally uncontended. */
+class EventLoop
+{
+public:
+    explicit EventLoop(WsHeartbeatConfig heartbeat = WsHeartbeatConfig());
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Accept connections on a port shared with the other loops; false (errno set) on failure
+    bool listen(int port);
+
+    // Run the loop on the calling thread, pinned to cpu if it is >= 0 (never returns)
+    void run(int cpu = -1);
+
+    // Hand a freshly accepted socket to this loop (any thread)
+    void adopt(int fd);
+
+    // Run task on this loop's thread (any thread)
+    void post(std::function<void()> task);
+
+    /*
+    Queue a request for this loop to answer (any thread). Each priority
+    has a bounded queue, and a bound on the unanswered input this loop's
+    own connections hold; false means the loop is past one of them and the
+    caller should shed the request. Every queued High item runs before the
+    next batch of Low ones, so polling can delay an action by at most one
+    batch. */
+    bool submit(WorkPriority priority, std::function<void()> work);
+    // Whether submit would take work of this priority now; the owner's own requests are held to it too
+    bool admits(WorkPriority priority);
+
+    // Read a connection whose reading was paused again, if it can take input now (owning loop only)
+    void resume_input(const ConnectionPtr &conn);
+
+    // Move a connection this loop owns, with its buffered input, to target (owning loop only)
+    void hand_off(const ConnectionPtr &conn, EventLoop &target);
+
+    // Loops that own matches; set once at startup, before any traffic
+    static void set_match_owners(std::vector<EventLoop *> loops);
+    // The loop that owns matchId, or nullptr when no owners are set
+    static EventLoop *owner_of(const std::string &matchId);
+
+private:
+    void wake();
+    // Room for more work of this priority (see submit). Requires pendingMutex
+    bool has_room_locked(WorkPriority priority) const;
+    // Bring bufferedInput up to date with conn's inbuf (owning loop only)
+    void sync_input(Connection &conn);
+    void register_pending();
+    void run_work();
+    void accept_pending();
+    void add_socket(int fd);
+    void add_connection(const ConnectionPtr &conn);
+    void on_readable(const ConnectionPtr &conn);
+    void close_connection(const ConnectionPtr &conn);
+
+    // HTTP connections ordered by last activity, least recent first
+    void touch(Connection &conn);
+    void untrack(Connection &conn);
+    void reap_idle();
+
+    // WebSocket deadlines; each live socket has one entry, rescheduled lazily
+    void schedule_heartbeat(const ConnectionPtr &conn, std::chrono::steady_clock::time_point deadline);
+    void check_heartbeat(const ConnectionPtr &conn, std::chrono::steady_clock::time_point now);
+    void run_heartbeats();
+
+    int epollFd;
+    int wakeFd;
+    int listenFd = -1;
+
+    std::mutex pendingMutex;
+    std::vector<int> pendingFds;
+    std::vector<std::function<void()>> pendingTasks;
+    std::deque<std::function<void()>> highWork;
+    std::deque<std::function<void()>> lowWork;
+    bool workBacklog = false; // Low work left over after the last batch
+    // inbuf bytes of this loop's connections not yet answered; written by the loop, read by submit
+    std::atomic<std::size_t> bufferedInput{0};
+
+    std::unordered_map<Connection *, ConnectionPtr> connections;
+    std::list<Connection *> idleList;
+
+    WsHeartbeatConfig heartbeat;
+    TimingWheel<std::weak_ptr<Connection>> heartbeats;
+    bool heartbeatBacklog = false; // the last pass hit its batch limit
+};
@@ -1,24 +1,85 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
+/*
+A parsed request head. Every view points into the receive buffer the head
+was parsed from and is only valid until that buffer is modified. */
 struct HttpRequest {
-    std::string method;
-    std::string path;   // path without query
-    std::string query;  // query string (after ?)
+    std::string_view method;
+    std::string_view path;   // path without query
+    std::string_view query;  // query string (after ?)
+    int versionMinor = 1;           // HTTP/1.x
+    std::size_t contentLength = 0;  // request body bytes following the head
+    bool keepAlive = false;         // connection persists after the response
+
+    // WebSocket handshake headers
+    bool upgradeWebsocket = false;   // Upgrade: websocket
+    bool connectionUpgrade = false;  // Connection: Upgrade
+    std::string_view secWebSocketKey;
+    std::string_view secWebSocketExtensions; // offered extensions, if any
+};
+
+enum class HttpParseStatus { Incomplete, Complete, Error };
+
+/*
+Resumable request-head parser. Call parse() with the whole receive buffer
+after every read; the search for the end of the head resumes where the
+previous call stopped, so each byte is scanned once. Once Complete, reset()
+before parsing the next pipelined request. */
+class HttpParser {
+public:
+    HttpParseStatus parse(std::string_view buf, HttpRequest &out);
+    std::size_t head_size() const { return headSize; } // valid once Complete
+    void reset() { scanned = 0; headSize = 0; }
+
+private:
+    std::size_t scanned = 0;  // bytes already searched for the blank line
+    std::size_t headSize = 0; // request line + headers + blank line
 };
 
 // Decode URL-encoded strings (e.g. %20, + to space)
-std::string url_decode(const std::string &s);
+std::string url_decode(std::string_view s);
+
+/*
+A query string split once into key/value views, in request order. Nothing
+is copied or decoded until a value is asked for, keys match exactly, and
+numbers are validated without exceptions. Parameters past MAX_PARAMS are
+ignored. */
+class QueryParams {
+public:
+    static const std::size_t MAX_PARAMS = 16;
+
+    explicit QueryParams(std::string_view query);
+
+    // Raw (still encoded) value; false if the key is absent
+    bool find(std::string_view key, std::string_view &raw) const;
+    // Decoded value, or "" if the key is absent
+    std::string get(std::string_view key) const;
+    // Whole value as a base-10 int; false if absent or malformed
+    bool get_int(std::string_view key, int &out) const;
+
+private:
+    struct Param {
+        std::string_view key;
+        std::string_view value;
+    };
+    Param params[MAX_PARAMS];
+    std::size_t count = 0;
+};
 
-// Extract a query parameter by name from "k1=v1&k2=v2"
-std::string get_query_param(const std::string &query, const std::string &key);
+// Extract a single query parameter by name from "k1=v1&k2=v2"
+std::string get_query_param(std::string_view query, std::string_view key);
 
-// Parse the first line of an HTTP request into method/path/query
-bool parse_http_request(const std::string &raw, HttpRequest &out);
+// Parse a complete request head (request line and headers) in a single pass
+bool parse_http_request(std::string_view head, HttpRequest &out);
 
-// Build a simple HTTP response with status, content-type, and body
+// Build a simple HTTP response with status, content-type, and body;
+// extraHeaders are complete "Name: value\r\n" lines
 std::string make_http_response(const std::string &body,
                                const std::string &contentType = "application/json",
                                int statusCode = 200,
-                               const std::string &statusText = "OK");
+                               const std::string &statusText = "OK",
+                               bool keepAlive = false,
+                               const std::string &extraHeaders = std::string());
@@ -1,3 +1,14 @@
 #pragma once
+#include "../include/connection.hpp"
 
-void handle_client_connection(int client_fd);
+// Drive the connection state machine after new bytes arrived in conn->inbuf
+void handle_client_connection(const ConnectionPtr &conn);
+
+// Continue with buffered input after another loop answered a request or handed the socket over
+void resume_client_connection(const ConnectionPtr &conn);
+
+// Input conn may have buffered before its loop stops reading the socket
+std::size_t max_pending_input(const Connection &conn);
+
+// Called by the owning loop right before the socket is closed
+void handle_client_disconnect(const ConnectionPtr &conn);
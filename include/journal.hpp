@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../include/state.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pb
+{
+    /*
+    Write-ahead journal of match changes, kept as numbered segment files
+    (journal-<generation>.log) next to a snapshot.bin that covers every
+    segment before its recorded generation. Every record is framed as
+        u32 length | u32 crc32 | u8 type | payload
+    so a torn write at the tail of a segment is detected and ignored.
+
+    Appends only copy the record into a buffer; a writer thread flushes
+    whatever has accumulated with one write + fdatasync (group commit), so
+    request handling never waits on the disk. Call the journal_* functions
+    with the match's shard lock held so records of one match stay ordered.
+
+    A failed write or fdatasync marks the journal failed: nothing from that
+    batch on is counted durable, later appends are dropped, and
+    journal_available() turns false so handlers stop acknowledging changes
+    until the process is restarted on a healthy disk. */
+
+    struct JournalReplayStats
+    {
+        std::size_t segments = 0;
+        std::size_t records = 0;
+        std::size_t snapshotMatches = 0; // mapped, materialized lazily
+        std::size_t tornTails = 0;
+    };
+
+    // Map dir's snapshot and replay the segments after it, oldest first
+    bool replay_journal(const std::string &dir, JournalReplayStats &stats, std::string &error);
+
+    // Replay dir, then start appending to a fresh segment in it
+    bool open_journal(const std::string &dir, std::string &error);
+
+    // Wait for everything appended so far to be durable, then stop the writer
+    void close_journal();
+
+    // Block until everything appended so far is on disk; false if the journal failed first
+    bool journal_sync();
+
+    // False once the open journal has failed; changes must not be acknowledged then
+    bool journal_available();
+
+    // Whole match state, written on creation; replay upserts it
+    void journal_match(const Match &m);
+    void journal_claim(const Match &m, int team);
+    // An action applied at stepIdx; replay skips it if that step was already taken
+    void journal_action(const Match &m, std::size_t stepIdx, int team, ActionType action, int value);
+    void journal_expire(const std::string &matchId);
+
+    /*
+    Start a new segment, snapshot the store and delete the segments the
+    snapshot covers. Runs alongside request handling, locking one shard at
+    a time. */
+    void compact_journal();
+
+    // Compact every few minutes, or sooner once segments outgrow the snapshot
+    void maybe_compact_journal();
+}
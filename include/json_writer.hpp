@@ -0,0 +1,47 @@
+#pragma once
+
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+Appends JSON text to a caller-owned buffer. Keys and punctuation go through
+raw(); values are formatted in place with no temporary strings, so
+rendering into a pre-sized buffer does not allocate. */
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::string &out) : out(out) {}
+
+    void raw(std::string_view s) { out.append(s.data(), s.size()); }
+    void raw(char c) { out.push_back(c); }
+
+    // Quoted, escaped string value
+    void string(std::string_view s);
+
+    template <class Int>
+    void integer(Int v)
+    {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        out.append(buf, static_cast<std::size_t>(res.ptr - buf));
+    }
+
+    // Comma separated integers wrapped in []
+    template <class Int>
+    void int_array(const std::vector<Int> &values)
+    {
+        out.push_back('[');
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            if (i)
+                out.push_back(',');
+            integer(values[i]);
+        }
+        out.push_back(']');
+    }
+
+private:
+    std::string &out;
+};
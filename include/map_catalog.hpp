@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pb
+{
+    struct Map
+    {
+        int id;
+        std::string name;
+        std::string previewUrl;
+        std::string mapImgUrl;
+    };
+
+    /*
+    Immutable map pool. Matches keep a reference to the catalog that was
+    current when they were created, so swapping in a new pool never changes
+    a veto that is already running. */
+    struct MapCatalog
+    {
+        std::vector<Map> maps;
+        std::string mapsJson; // pre-rendered "availableMaps":[...] section
+        std::uint64_t generation = 0;
+    };
+
+    using MapCatalogPtr = std::shared_ptr<const MapCatalog>;
+
+    // Catalog used by new matches (lock-free read)
+    MapCatalogPtr current_map_catalog();
+    void set_map_catalog(MapCatalogPtr catalog);
+
+    // The built-in Valorant pool
+    MapCatalogPtr default_map_catalog();
+
+    /*
+    Read a catalog file: one map per line as "id,name,previewUrl,mapImgUrl",
+    blank lines and lines starting with # ignored. Returns nullptr on error. */
+    MapCatalogPtr load_map_catalog(const std::string &path, std::string &error);
+
+    // Load path and swap it in; keeps the current catalog on failure
+    bool reload_map_catalog(const std::string &path);
+}
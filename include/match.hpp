@@ -4,21 +4,53 @@
 #include <string>
 #include <random>
 #include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 #include <unistd.h>
 #include "../include/state.hpp"
+#include "../include/connection.hpp"
 
-struct WsClient {
-    int fd;
-    std::string matchId;
+// WebSocket subscribers of the matches in one shard, keyed by match id
+struct SubscriberShard {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unordered_set<ConnectionPtr>> byMatch;
 };
 
 struct MatchContext {
-    std::mutex matchMutex;
-    std::mutex wsClientsMutex;
-    std::vector<WsClient> wsClients;
+    SubscriberShard subscribers[pb::MATCH_SHARD_COUNT];
 };
 
 
 MatchContext& get_match_context();
-void handle_websocket_client(int client_fd);
-void broadcast_match_update(const pb::Match& m);
\ No newline at end of file
+
+/*
+Spectator protocol: the first text frame names the match to follow and is
+answered with a full snapshot (match_to_json), or, if there is no such match,
+{"type":"error","status":404,...} and a close frame. Every applied action is then
+pushed as a versioned patch (match_to_patch_json). A client that sees a
+version gap sends "resync" and gets a fresh snapshot. A subscriber's socket
+moves to the event loop that owns its match before it is registered.
+
+Captains can act on the subscribed match without a new HTTP request by
+sending the /match/action parameters as a text frame:
+    action=ban&team=0&map=3&token=...&rid=7
+The patch is broadcast as usual; the sender then gets
+    {"type":"ack","rid":"7","version":4}
+or  {"type":"error","rid":"7","status":403,"error":"..."}
+with the status /match/action would have answered. rid is optional. */
+void handle_websocket_client(const ConnectionPtr& conn);
+void remove_websocket_client(const ConnectionPtr& conn);
+// Unsubscribe and disconnect everyone following a match that no longer exists
+void drop_match_subscribers(const std::string& matchId);
+// Push the change made by the action applied at stepIdx; call with the match locked
+void broadcast_match_update(pb::Match& m, std::size_t stepIdx);
+// Apply an action to a locked match, journal it and push the patch to subscribers
+bool perform_action(pb::Match& m, int team, pb::ActionType action, int value);
+
+// Unavailable: the journal has failed, so the action could not be made durable
+enum class CaptainActionResult { Applied, InvalidTeam, Forbidden, Rejected, Unavailable };
+// "ban", "pick" or "side"; false for anything else
+bool parse_action_type(std::string_view name, pb::ActionType& out);
+// Check team's captain token, then perform_action; call with the match locked
+CaptainActionResult perform_captain_action(pb::Match& m, int team, const std::string& token,
+                                           pb::ActionType action, int value);
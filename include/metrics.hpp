@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+Process-wide counters for the /metrics endpoint (Prometheus text format).
+Every update is a single relaxed atomic add, so instrumented hot paths
+never take a lock; each metric sits on its own cache line so I/O threads
+bumping different metrics do not contend. Values are only read by
+render_metrics, which tolerates slightly torn snapshots across metrics. */
+namespace metrics
+{
+    class alignas(64) Counter
+    {
+    public:
+        void add(std::uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint64_t> value_{0};
+    };
+
+    class alignas(64) Gauge
+    {
+    public:
+        void add(std::int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+        std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::int64_t> value_{0};
+    };
+
+    /*
+    Fixed buckets given as inclusive upper bounds in the unit observations
+    are recorded in; scale converts that unit to the exported one (e.g.
+    1e-9 for nanoseconds reported as seconds). The buckets and the sum each
+    get a cache line of their own, apart from the read-only bounds. */
+    class alignas(64) Histogram
+    {
+    public:
+        Histogram(std::initializer_list<std::uint64_t> bounds, double scale = 1.0);
+
+        void observe(std::uint64_t value);
+
+        // Append the _bucket, _sum and _count lines; labels go inside {} and may be empty
+        void render(std::string &out, std::string_view name, std::string_view labels) const;
+
+    private:
+        struct alignas(64) Bucket
+        {
+            std::atomic<std::uint64_t> count{0};
+        };
+
+        std::vector<std::uint64_t> bounds;
+        std::unique_ptr<Bucket[]> counts; // bounds.size() + 1 for +Inf
+        double scale;
+        alignas(64) std::atomic<std::uint64_t> sum{0};
+    };
+
+    // Monotonic nanoseconds, for timing observations
+    inline std::uint64_t now_ns()
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now().time_since_epoch())
+                                              .count());
+    }
+
+    enum class HttpRoute
+    {
+        Create,
+        State,
+        Action,
+        Join,
+        Egress,
+        WebSocket,
+        Metrics,
+        Other,
+        Count
+    };
+
+    HttpRoute http_route(std::string_view path);
+
+    // A request answered with statusCode, and how long handling it took (0 if untimed)
+    void record_http_request(HttpRoute route, int statusCode, std::uint64_t durationNs);
+
+    extern Gauge websocketClients;
+    extern Counter websocketHeartbeatTimeouts;
+    extern Counter bytesSent; // everything written to client sockets
+    extern Histogram broadcastFanout;
+    extern Histogram broadcastDuration; // ns
+    extern Counter matchLockContended;  // shard lock acquisitions that had to wait
+    extern Histogram matchLockWait;     // ns, contended acquisitions only
+
+    // The whole exposition, in Prometheus text format 0.0.4
+    std::string render_metrics();
+}
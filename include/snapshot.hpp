@@ -0,0 +1,130 @@
+#pragma once
+
+#include "../include/state.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace pb
+{
+    /*
+    On-disk snapshot of the whole match store, read in place through mmap:
+
+        SnapshotHeader
+        SnapshotMatch[matchCount]   sorted by id, for binary search
+        blob                        strings and int32 arrays the records refer to
+
+    All integers are little-endian. Bump SNAPSHOT_VERSION whenever a struct
+    below changes. */
+    const char SNAPSHOT_MAGIC[8] = {'M', 'V', 'S', 'N', 'A', 'P', '\r', '\n'};
+    const std::uint32_t SNAPSHOT_VERSION = 1;
+    const std::size_t SNAPSHOT_ID_SIZE = 16; // ids are NUL padded to this width
+
+    // A slice of the blob: byte length for strings, element count for arrays
+    struct SnapshotRef
+    {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t recordSize;         // sizeof(SnapshotMatch) when written
+        std::uint64_t journalGeneration;  // first journal segment not folded in
+        std::uint64_t matchCount;
+        std::uint64_t blobOffset;
+        std::uint64_t blobSize;
+    };
+
+    struct SnapshotMatch
+    {
+        char id[SNAPSHOT_ID_SIZE];
+        std::uint64_t version;
+        std::uint32_t currentStepIndex;
+        std::int32_t currentTurnTeam;
+        std::int32_t deciderSide;
+        std::int32_t deciderSidePickerTeam;
+        std::int32_t deciderMapId;
+        std::int32_t currentSideMapId;
+        std::uint8_t phase;
+        std::uint8_t reserved[7];
+        SnapshotRef format; // name, resolved with find_veto_format
+        SnapshotRef teamNames[2];
+        SnapshotRef captainTokens[2];
+        SnapshotRef bannedMapIds[2];
+        SnapshotRef pickedMapIds[2];
+        SnapshotRef mapSides; // (mapId, side) pairs, length counts pairs
+        SnapshotRef stepMapIds;
+        SnapshotRef stepSideVals;
+    };
+
+    static_assert(std::is_trivially_copyable<SnapshotMatch>::value, "snapshot records are copied as bytes");
+    static_assert(sizeof(SnapshotHeader) == 48, "snapshot header layout changed");
+    static_assert(sizeof(SnapshotMatch) == 152, "snapshot record layout changed");
+
+    // Read-only mapping of a snapshot file
+    class SnapshotView
+    {
+    public:
+        ~SnapshotView();
+        SnapshotView(const SnapshotView &) = delete;
+        SnapshotView &operator=(const SnapshotView &) = delete;
+
+        // Map path and check its header; nullptr and error on failure
+        static std::shared_ptr<const SnapshotView> open(const std::string &path, std::string &error);
+
+        const SnapshotHeader &header() const { return *hdr; }
+        std::size_t size() const { return static_cast<std::size_t>(hdr->matchCount); }
+        const SnapshotMatch &record(std::size_t i) const { return records[i]; }
+        std::string_view id(const SnapshotMatch &rec) const;
+
+        // Index of the record for matchId, or -1
+        std::ptrdiff_t find(std::string_view matchId) const;
+
+        // Blob accessors; ok is cleared if ref points outside the blob
+        std::string_view string(SnapshotRef ref, bool &ok) const;
+        std::vector<int> ints(SnapshotRef ref, bool &ok) const;
+
+    private:
+        SnapshotView() = default;
+
+        void *base = nullptr;
+        std::size_t length = 0;
+        const SnapshotHeader *hdr = nullptr;
+        const SnapshotMatch *records = nullptr;
+        const char *blob = nullptr;
+    };
+
+    // Rebuild a match from a record; false if it is inconsistent or its format is unknown
+    bool decode_snapshot_match(const SnapshotView &view, const SnapshotMatch &rec, Match &out);
+
+    /*
+    Write every match to path (via a temporary file and rename), visiting one
+    shard at a time so requests keep flowing. journalGeneration is the first
+    segment whose records are not guaranteed to be included. */
+    bool write_snapshot(const std::string &path, std::uint64_t journalGeneration, std::string &error);
+
+    /*
+    Map a snapshot as the base of the store. Nothing is decoded up front:
+    get_match materializes a match on first access and warm_snapshot moves
+    the rest over in the background. */
+    bool load_snapshot(const std::string &path, std::uint64_t &journalGeneration,
+                       std::size_t &matchCount, std::string &error);
+
+    // Materialize every match still in the loaded snapshot, then unmap it
+    void warm_snapshot();
+    // Unmap the loaded snapshot without materializing the rest
+    void discard_snapshot();
+
+    // Take matchId out of the loaded snapshot; call with its shard locked
+    bool take_snapshot_match(const std::string &matchId, Match &out);
+    // The store now owns matchId; the snapshot copy must never resurface
+    void forget_snapshot_match(const std::string &matchId);
+}
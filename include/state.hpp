@@ -6,12 +6,30 @@
 #include <map>
 #include <iostream>
 #include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <functional>
+#include "../include/map_catalog.hpp"
 
 namespace pb
 {
     const int TEAM_A = 0;
     const int TEAM_B = 1;
     const int UNASSIGNED_MAP_ID = 0;
+    // Matches are spread over independently locked shards by slot index
+    const std::size_t MATCH_SHARD_COUNT = 64;
+    /*
+    Match ids are 4 base-36 digits of the match's slot index, 2 of the slot's
+    generation (bumped every time it is freed) and 6 random characters from
+    the kernel CSPRNG, as unguessable as the old all-random 6 character ids.
+    Live ids never collide. A slot's generation only moves forward but wraps
+    after 36 * 36 reuses; an old id then still differs in its random part. */
+    const std::size_t MATCH_ID_SIZE = 12;
+    const std::size_t MAX_MATCHES = 36 * 36 * 36 * 36; // live at once
+    // Matches are dropped once this long has passed since their last action
+    const std::chrono::minutes MATCH_TTL{30};
     enum class Phase
     {
         BanPhase = 0,
@@ -19,6 +37,7 @@ namespace pb
         SidePhase = 2,
         Completed = 3
     };
+    const std::size_t PHASE_COUNT = 4;
 
     enum class ActionType
     {
@@ -27,14 +46,6 @@ namespace pb
         Side
     };
 
-    struct Map
-    {
-        int id;
-        std::string name;
-        std::string previewUrl;
-        std::string mapImgUrl;
-    };
-
     struct TeamSlot
     {
         std::string playerName;
@@ -54,6 +65,8 @@ namespace pb
         int teamIndex;
     };
 
+    struct VetoFormat;
+
     struct Match
     {
         std::string id;
@@ -62,11 +75,11 @@ namespace pb
         int currentTurnTeam;          // Index of the team whose turn it is
         std::size_t currentStepIndex; // Index of the current step in the pick/ban sequence
         std::chrono::steady_clock::time_point lastUpdated;
-        std::string seriesType;
+        const VetoFormat *format;     // pick/ban sequence; its name is the seriesType
+        std::uint64_t version = 0;    // bumped by every applied action
 
         Team teams[2];
-        std::vector<Map> availableMaps;
-        std::vector<Step> steps;
+        MapCatalogPtr catalog;        // shared map pool, fixed at creation
         std::string teamCaptainTokens[2];
         int deciderSide = -1;
         int deciderSidePickerTeam = -1;
@@ -77,14 +90,89 @@ namespace pb
         int currentSideMapId = 0;      // The ID of the map we are currently picking a side for
         std::vector<int> stepMapIds;   // map chosen for each step index (0 if not set)
         std::vector<int> stepSideVals; // side for Side steps: -1 unset, 0 atk, 1 def
+
+        // WebSocket payload bytes pushed to this match's subscribers, before and
+        // after permessage-deflate; runtime statistics, not journaled
+        std::uint64_t wsUncompressedBytes = 0;
+        std::uint64_t wsSentBytes = 0;
     };
+
+    /*
+    Locked access to one match; holds its shard lock for as long as it lives.
+    If the match changed phase meanwhile, the shard's phase counts are moved
+    over just before the lock is released. */
+    class MatchHandle
+    {
+    public:
+        MatchHandle() = default;
+        MatchHandle(std::unique_lock<std::mutex> lock, Match *match, std::atomic<std::size_t> *phaseCounts)
+            : lock(std::move(lock)), match(match), phaseCounts(phaseCounts), phase(match->phase) {}
+        MatchHandle(MatchHandle &&other) noexcept
+            : lock(std::move(other.lock)), match(std::exchange(other.match, nullptr)),
+              phaseCounts(other.phaseCounts), phase(other.phase) {}
+        MatchHandle &operator=(MatchHandle &&other) noexcept
+        {
+            if (this != &other)
+            {
+                settle_phase();
+                lock = std::move(other.lock);
+                match = std::exchange(other.match, nullptr);
+                phaseCounts = other.phaseCounts;
+                phase = other.phase;
+            }
+            return *this;
+        }
+        ~MatchHandle() { settle_phase(); }
+
+        explicit operator bool() const { return match != nullptr; }
+        Match *operator->() const { return match; }
+        Match &operator*() const { return *match; }
+
+    private:
+        void settle_phase()
+        {
+            if (match && match->phase != phase)
+            {
+                phaseCounts[static_cast<std::size_t>(phase)].fetch_sub(1, std::memory_order_relaxed);
+                phaseCounts[static_cast<std::size_t>(match->phase)].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock;
+        Match *match = nullptr;
+        std::atomic<std::size_t> *phaseCounts = nullptr;
+        Phase phase = Phase::BanPhase;
+    };
+
     void init_state();
-    Match &create_match(const std::string &teamAName, const std::string &teamBName, std::string series);
-    Match *get_match(const std::string &matchId);
+    std::size_t match_shard_index(const std::string &matchId);
+    // Empty handle if all MAX_MATCHES slots are in use
+    MatchHandle create_match(const std::string &teamAName, const std::string &teamBName, std::string series);
+    MatchHandle get_match(const std::string &matchId);
+    // Insert or replace a fully built match (journal replay); its TTL starts now.
+    // Empty handle if all MAX_MATCHES slots are in use
+    MatchHandle restore_match(Match m);
+    bool erase_match(const std::string &matchId);
+    // Visit every match (pulling in any left in a loaded snapshot), one shard lock at a time
+    void for_each_match(const std::function<void(const Match &)> &fn);
+    // Tally in-memory matches by phase (those still only in a loaded snapshot are not counted);
+    // reads counts kept per shard, so it takes no locks
+    void count_matches_by_phase(std::size_t counts[PHASE_COUNT]);
 
     bool apply_action(Match &m, int teamIndex, ActionType action, int mapId);
     std::string match_to_json(const Match &m);
+    // Render match_to_json's output onto the end of a reusable buffer
+    void append_match_json(const Match &m, std::string &out);
     std::string match_to_light_json(const Match &m);
-    std::string generate_match_id();
-    void prune_old_matches(std::chrono::seconds maxAge);
+    // What the action applied at stepIdx changed, as a patch on top of version - 1
+    std::string match_to_patch_json(const Match &m, std::size_t stepIdx);
+    // Id for the match in slot at the given generation, with a fresh random part
+    std::string generate_match_id(std::size_t slot, std::uint32_t generation);
+    using MatchExpiredFn = std::function<void(const std::string &matchId)>;
+    /*
+    Drop matches idle for longer than MATCH_TTL, visiting at most maxBatch
+    expiry entries per shard so no lock is held for long. Returns the number
+    of matches removed; call again soon if work may remain. */
+    std::size_t expire_matches(std::chrono::steady_clock::time_point now, std::size_t maxBatch,
+                               const MatchExpiredFn &onExpired = {});
 };
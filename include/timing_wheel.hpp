@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+Hashed timing wheel. An entry lives in the slot of its deadline tick; one
+that is more than a revolution away simply stays put until the wheel comes
+round again. advance() only visits slots that are due and stops after
+maxBatch entries, so every call does a bounded amount of work.
+Not thread-safe; callers serialize access. */
+template <class T>
+class TimingWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimingWheel(Clock::duration tick, std::size_t slotCount, Clock::time_point origin = Clock::now())
+        : slots(slotCount), tick(tick), origin(origin)
+    {
+    }
+
+    void schedule(Clock::time_point deadline, T value)
+    {
+        std::uint64_t t = tick_of(deadline);
+        if (t < currentTick)
+            t = currentTick; // already due: handled on the next advance
+        slots[t % slots.size()].push_back(Entry{deadline, std::move(value)});
+        ++count;
+    }
+
+    /*
+    Remove up to maxBatch entries whose deadline is <= now and pass each to
+    fn. Returns how many were removed; a full batch means more may be due. */
+    template <class Fn>
+    std::size_t advance(Clock::time_point now, std::size_t maxBatch, Fn &&fn)
+    {
+        std::size_t done = 0;
+        std::uint64_t nowTick = tick_of(now);
+
+        while (currentTick <= nowTick)
+        {
+            std::vector<Entry> &slot = slots[currentTick % slots.size()];
+            for (std::size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].deadline > now)
+                {
+                    ++i; // a later revolution, or later within this tick
+                    continue;
+                }
+                if (done == maxBatch)
+                    return done;
+
+                T value = std::move(slot[i].value);
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+                --count;
+                ++done;
+                fn(std::move(value));
+            }
+
+            // leave the current tick open until it has fully elapsed
+            if (currentTick == nowTick)
+                break;
+            ++currentTick;
+        }
+        return done;
+    }
+
+    std::size_t size() const { return count; }
+
+    void clear()
+    {
+        for (auto &slot : slots)
+            slot.clear();
+        count = 0;
+    }
+
+private:
+    struct Entry
+    {
+        Clock::time_point deadline;
+        T value;
+    };
+
+    std::uint64_t tick_of(Clock::time_point t) const
+    {
+        if (t <= origin)
+            return 0;
+        return static_cast<std::uint64_t>((t - origin) / tick);
+    }
+
+    std::vector<std::vector<Entry>> slots;
+    Clock::duration tick;
+    Clock::time_point origin;
+    std::uint64_t currentTick = 0; // oldest tick that may still hold due entries
+    std::size_t count = 0;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "../include/state.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pb
+{
+    // How a format settles its decider map
+    enum class DeciderRule : std::uint8_t
+    {
+        PickedMap,   // the map from the last pick is the decider; its side step sets deciderSide
+        RemainingMap // the one map left before the final side step becomes the decider
+    };
+
+    enum class SeriesFormat : std::uint8_t
+    {
+        Bo1,
+        Bo3,
+        Bo5,
+        Custom
+    };
+
+    /*
+    A pick/ban sequence with everything apply_action needs precomputed.
+    Formats are immutable once registered and matches point at them. */
+    struct VetoFormat
+    {
+        std::string name; // seriesType reported to clients
+        SeriesFormat series;
+        DeciderRule decider;
+        std::vector<Step> steps;
+        std::vector<Phase> phaseAt; // phase while currentStepIndex == i; back() is Completed
+        std::size_t deciderStep;    // RemainingMap: step at which the decider map is fixed
+        std::string stepsJson;      // pre-rendered "steps":[...] section
+    };
+
+    const VetoFormat &veto_format(SeriesFormat series);
+
+    // Look a format up by its seriesType name; nullptr if unknown
+    const VetoFormat *find_veto_format(const std::string &name);
+
+    // Maps a sequence uses up: one per ban or pick, plus the decider a RemainingMap format leaves
+    std::size_t maps_needed(DeciderRule decider, const std::vector<Step> &steps);
+    // The most maps any registered format needs; smaller map pools are refused
+    std::size_t max_maps_needed();
+
+    /*
+    Register a custom format. Must happen at startup, before requests are
+    served. Returns nullptr and sets error if the sequence is not playable,
+    including when the current map pool has too few maps to finish it. */
+    const VetoFormat *register_veto_format(const std::string &name, DeciderRule decider,
+                                           const std::vector<Step> &steps, std::string &error);
+
+    /*
+    Register every format in a file, one per line:
+        name picked|remaining ban:A ban:B pick:A side:B ...
+    Blank lines and lines starting with # are ignored. */
+    bool load_veto_formats(const std::string &path, std::string &error);
+}
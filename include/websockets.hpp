@@ -9,12 +9,66 @@
 #include <openssl/sha.h>
 #include <sstream>
 #include <algorithm>
+#include "../include/connection.hpp"
+#include "../include/http.hpp"
+#include "../include/ws_frame.hpp"
+#include "../include/ws_deflate.hpp"
 
 
 // Handshake helpers
-bool is_websocket_upgrade(const std::string& raw, std::string& secKeyOut);
-std::string compute_websocket_accept(const std::string& secKey);
+bool is_websocket_upgrade(const HttpRequest& req);
+std::string compute_websocket_accept(std::string_view secKey);
 
-// Frame helpers
-bool recv_ws_frame(int fd, std::string& outPayload); 
-void send_ws_text(int fd, const std::string& msg);     
\ No newline at end of file
+// Frame helpers; decoding lives in ws_frame.hpp
+
+/*
+A server frame. Header and payload are separate buffers that go out in one
+vectored write, so the payload is never copied and one frame can be queued
+on any number of connections. */
+struct WsOutFrame {
+    SharedBuffer header;
+    SharedBuffer payload;
+};
+
+// compressed sets RSV1: the payload is a permessage-deflate message
+WsOutFrame make_ws_frame(uint8_t opcode, SharedBuffer payload, bool compressed = false);
+WsOutFrame make_ws_frame(uint8_t opcode, std::string payload);
+WsOutFrame make_ws_text_frame(std::string msg);
+void send_ws_frame(Connection& conn, const WsOutFrame& frame);
+// Compressed if the connection negotiated permessage-deflate and it helps
+// Returns the payload bytes queued, after compression if it was used
+std::size_t send_ws_text(Connection& conn, std::string msg);
+
+/*
+One text message for many connections. The plain frame is built up front;
+the compressed one on first use by a client that negotiated
+permessage-deflate, and then shared by all of them. */
+class WsBroadcastFrame {
+public:
+    explicit WsBroadcastFrame(std::string msg);
+    ~WsBroadcastFrame(); // adds what was sent to the egress counters
+
+    void send(Connection& conn);
+
+    // Payload bytes queued so far, before and after compression
+    uint64_t uncompressed_bytes() const { return messages * plain.payload->size(); }
+    uint64_t sent_bytes() const { return sentBytes; }
+
+private:
+    WsOutFrame plain;
+    WsOutFrame deflated;
+    bool deflateTried = false;
+    uint64_t messages = 0;
+    uint64_t deflatedMessages = 0;
+    uint64_t sentBytes = 0;
+};
+
+// Text messages queued since startup; payload bytes before and after compression
+struct WsEgressStats {
+    uint64_t messages = 0;
+    uint64_t deflatedMessages = 0;
+    uint64_t uncompressedBytes = 0;
+    uint64_t sentBytes = 0;
+};
+
+WsEgressStats ws_egress_stats();
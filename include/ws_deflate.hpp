@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+// permessage-deflate (RFC 7692) for WebSocket messages
+
+struct WsDeflateParams
+{
+    bool clientNoContextTakeover = false; // the client resets its compressor per message
+};
+
+/*
+Accept the first permessage-deflate offer in a Sec-WebSocket-Extensions
+value that we can honour. The server side always compresses each message
+on its own (server_no_context_takeover) with the default 15-bit window, so
+one compressed frame can be shared by every client that negotiated it.
+Offers asking for a smaller server window are declined. */
+bool negotiate_permessage_deflate(std::string_view offers, WsDeflateParams& params);
+
+// Sec-WebSocket-Extensions value answering an accepted offer
+std::string permessage_deflate_response(const WsDeflateParams& params);
+
+// Compress one message from a fresh context; false if it would not shrink
+bool deflate_message(std::string_view msg, std::string& out);
+
+// Decompresses one client's messages, keeping the window between them unless the client gave it up
+class WsInflater
+{
+public:
+    explicit WsInflater(bool resetEachMessage);
+    ~WsInflater();
+    WsInflater(const WsInflater&) = delete;
+    WsInflater& operator=(const WsInflater&) = delete;
+
+    // False on corrupt input or output beyond MAX_WS_MESSAGE_BYTES
+    bool inflate_message(std::string_view data, std::string& out);
+
+private:
+    z_stream zs{};
+    bool ok = false;
+    bool resetEachMessage;
+};
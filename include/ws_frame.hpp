@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Frame opcodes (RFC 6455 section 5.2)
+const uint8_t WS_OPCODE_CONTINUATION = 0x0;
+const uint8_t WS_OPCODE_TEXT = 0x1;
+const uint8_t WS_OPCODE_BINARY = 0x2;
+const uint8_t WS_OPCODE_CLOSE = 0x8;
+const uint8_t WS_OPCODE_PING = 0x9;
+const uint8_t WS_OPCODE_PONG = 0xA;
+
+// Largest client frame or reassembled message we accept
+const std::size_t MAX_WS_MESSAGE_BYTES = 64 * 1024;
+
+enum class WsFrameStatus { Incomplete, Frame, Error };
+
+struct WsFrame
+{
+    bool fin;
+    bool compressed; // RSV1: permessage-deflate, first frame of a message only
+    uint8_t opcode;
+    std::string_view payload; // unmasked, inside the receive buffer
+};
+
+/*
+Decode one client frame from the front of a receive buffer. On Frame the
+payload is unmasked in place and consumed is set; on Incomplete nothing is
+modified, so the call can simply be repeated once more bytes arrive. RSV1
+is passed through as compressed; whether that was negotiated is up to the
+caller. */
+WsFrameStatus parse_ws_frame(char* data, std::size_t len, std::size_t& consumed, WsFrame& frame);
+
+// XOR data with the 4-byte masking key, eight bytes at a time
+void ws_unmask(char* data, std::size_t len, const uint8_t key[4]);
+
+/*
+Reassembles fragmented data messages. Control frames may be interleaved
+with fragments and are passed straight through. */
+class WsMessageAssembler
+{
+public:
+    enum class Result { Pending, Message, Control, Error };
+
+    /*
+    Feed the next frame. On Message or Control, opcode and payload describe
+    it; payload stays valid until the next call or until the frame's bytes
+    leave the receive buffer. */
+    Result feed(const WsFrame& frame, uint8_t& opcode, std::string_view& payload);
+
+    // Whether the last Message was sent compressed (RSV1 on its first frame)
+    bool compressed() const { return messageCompressed; }
+
+private:
+    std::string fragments;
+    uint8_t messageOpcode = 0;
+    bool messageCompressed = false;
+    bool inMessage = false;
+};
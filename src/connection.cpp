@@ -0,0 +1,127 @@
+#include "../include/connection.hpp"
+#include "../include/metrics.hpp"
+
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// A client that lets this much output pile up is too slow to keep up
+static const std::size_t MAX_QUEUED_BYTES = 4 * 1024 * 1024;
+// Past this much queued output the loop stops answering and reading until it drains
+static const std::size_t BACKLOG_BYTES = MAX_QUEUED_BYTES / 4;
+
+// Buffers handed to a single sendmsg() call
+static const std::size_t MAX_IOV = 64;
+
+Connection::Connection(int fd, EventLoop *loop)
+    : fd(fd), loop(loop)
+{
+}
+
+bool Connection::enqueue_locked(SharedBuffer data)
+{
+    if (data->empty())
+        return true;
+    if (queuedBytes + data->size() > MAX_QUEUED_BYTES)
+    {
+        overflowed = true;
+        ::shutdown(fd, SHUT_RDWR);
+        return false;
+    }
+    queuedBytes += data->size();
+    outQueue.push_back(std::move(data));
+    return true;
+}
+
+void Connection::send(SharedBuffer data)
+{
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (closed || !enqueue_locked(std::move(data)))
+        return;
+    flush_locked();
+}
+
+void Connection::send(SharedBuffer first, SharedBuffer second)
+{
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (closed || !enqueue_locked(std::move(first)) || !enqueue_locked(std::move(second)))
+        return;
+    flush_locked();
+}
+
+void Connection::close_after_flush()
+{
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (closed)
+        return;
+    closeAfterFlush = true;
+    flush_locked();
+}
+
+bool Connection::output_backlogged()
+{
+    std::lock_guard<std::mutex> lock(outMutex);
+    return overflowed || queuedBytes >= BACKLOG_BYTES;
+}
+
+void Connection::shutdown()
+{
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (!closed)
+        ::shutdown(fd, SHUT_RDWR);
+}
+
+void Connection::flush_locked()
+{
+    while (!outQueue.empty())
+    {
+        // gather as much of the queue as fits into one call
+        iovec iov[MAX_IOV];
+        std::size_t count = 0;
+        for (auto it = outQueue.begin(); it != outQueue.end() && count < MAX_IOV; ++it, ++count)
+        {
+            const std::string &buf = **it;
+            std::size_t skip = count == 0 ? outOffset : 0;
+            iov[count].iov_base = const_cast<char *>(buf.data() + skip);
+            iov[count].iov_len = buf.size() - skip;
+        }
+
+        // sendmsg rather than writev: only send* take MSG_NOSIGNAL
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0)
+        {
+            // drop fully written buffers; a partial one keeps its offset
+            std::size_t written = static_cast<std::size_t>(n);
+            queuedBytes -= written;
+            metrics::bytesSent.add(written);
+            while (written > 0)
+            {
+                std::size_t left = outQueue.front()->size() - outOffset;
+                if (written < left)
+                {
+                    outOffset += written;
+                    break;
+                }
+                written -= left;
+                outQueue.pop_front();
+                outOffset = 0;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return; // the loop resumes on EPOLLOUT
+
+        // peer is gone; the loop will see the hangup and clean up
+        ::shutdown(fd, SHUT_RDWR);
+        return;
+    }
+
+    if (closeAfterFlush)
+        ::shutdown(fd, SHUT_WR);
+}
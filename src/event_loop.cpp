@@ -0,0 +1,562 @@
+#include "../include/event_loop.hpp"
+#include "../include/http_router.hpp"
+#include "../include/websockets.hpp"
+#include "../include/metrics.hpp"
+#include "../include/state.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const int MAX_EVENTS = 256;
+
+// Heartbeat deadlines are kept to the second, on a wheel of this many slots
+static const std::chrono::seconds HEARTBEAT_TICK{1};
+static const std::size_t HEARTBEAT_SLOTS = 256;
+// Sockets checked per loop iteration, so a burst of deadlines never stalls I/O
+static const std::size_t HEARTBEAT_BATCH = 1024;
+// Connections accepted per readiness event before other sockets get a turn
+static const int ACCEPT_BATCH = 64;
+// Request work queued by other loops; beyond these the sender answers 503
+static const std::size_t HIGH_WORK_LIMIT = 4096;
+static const std::size_t LOW_WORK_LIMIT = 1024;
+// Unanswered input held by a loop's own connections; beyond these it sheds the same way
+static const std::size_t HIGH_INPUT_LIMIT = 1024 * 1024;
+static const std::size_t LOW_INPUT_LIMIT = 256 * 1024;
+// Low-priority items run per loop iteration, between checks for High work and I/O
+static const std::size_t LOW_WORK_BATCH = 128;
+
+// Set once by set_match_owners before any loop runs, then only read
+static std::vector<EventLoop *> g_matchOwners;
+
+EventLoop::EventLoop(WsHeartbeatConfig heartbeat)
+    : heartbeat(heartbeat), heartbeats(HEARTBEAT_TICK, HEARTBEAT_SLOTS)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0)
+    {
+        perror("epoll");
+        std::abort();
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // nullptr marks the wakeup eventfd
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+EventLoop::~EventLoop()
+{
+    if (listenFd >= 0)
+        close(listenFd);
+    close(wakeFd);
+    close(epollFd);
+}
+
+bool EventLoop::listen(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    // every loop binds the same port; the kernel spreads new connections across them
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &listenFd; // marks the listening socket
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        ::listen(fd, SOMAXCONN) < 0 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+    listenFd = fd;
+    return true;
+}
+
+void EventLoop::wake()
+{
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = write(wakeFd, &one, sizeof(one));
+}
+
+void EventLoop::adopt(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingFds.push_back(fd);
+    }
+    wake();
+}
+
+void EventLoop::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingTasks.push_back(std::move(task));
+    }
+    wake();
+}
+
+bool EventLoop::has_room_locked(WorkPriority priority) const
+{
+    const std::size_t input = bufferedInput.load(std::memory_order_relaxed);
+    if (priority == WorkPriority::High)
+        return highWork.size() < HIGH_WORK_LIMIT && input < HIGH_INPUT_LIMIT;
+    return lowWork.size() < LOW_WORK_LIMIT && input < LOW_INPUT_LIMIT;
+}
+
+bool EventLoop::submit(WorkPriority priority, std::function<void()> work)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (!has_room_locked(priority))
+            return false;
+        (priority == WorkPriority::High ? highWork : lowWork).push_back(std::move(work));
+    }
+    wake();
+    return true;
+}
+
+bool EventLoop::admits(WorkPriority priority)
+{
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    return has_room_locked(priority);
+}
+
+void EventLoop::sync_input(Connection &conn)
+{
+    const std::size_t now = conn.inbuf.size();
+    if (now >= conn.accountedInput)
+        bufferedInput.fetch_add(now - conn.accountedInput, std::memory_order_relaxed);
+    else
+        bufferedInput.fetch_sub(conn.accountedInput - now, std::memory_order_relaxed);
+    conn.accountedInput = now;
+}
+
+void EventLoop::run_work()
+{
+    std::deque<std::function<void()>> high;
+    std::vector<std::function<void()>> low;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        high.swap(highWork);
+        std::size_t n = std::min(lowWork.size(), LOW_WORK_BATCH);
+        low.reserve(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            low.push_back(std::move(lowWork.front()));
+            lowWork.pop_front();
+        }
+        workBacklog = !lowWork.empty();
+    }
+
+    for (auto &work : high)
+        work();
+    for (auto &work : low)
+        work();
+}
+
+void EventLoop::set_match_owners(std::vector<EventLoop *> loops)
+{
+    g_matchOwners = std::move(loops);
+}
+
+EventLoop *EventLoop::owner_of(const std::string &matchId)
+{
+    if (g_matchOwners.empty())
+        return nullptr;
+    // whole shards map to one loop, so a shard's lock is only taken by its owner's I/O
+    return g_matchOwners[pb::match_shard_index(matchId) % g_matchOwners.size()];
+}
+
+void EventLoop::accept_pending()
+{
+    for (int i = 0; i < ACCEPT_BATCH; ++i)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        add_socket(fd);
+    }
+
+    // edge-triggered: the backlog may not be empty, so come back to it
+    post([this]()
+         { accept_pending(); });
+}
+
+void EventLoop::hand_off(const ConnectionPtr &conn, EventLoop &target)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    untrack(*conn);
+    bufferedInput.fetch_sub(conn->accountedInput, std::memory_order_relaxed); // target counts it now
+    conn->accountedInput = 0;
+    conn->heartbeatScheduled = false; // entries left on this wheel are skipped
+    conn->loop = &target;
+    ConnectionPtr moved = conn;
+    connections.erase(conn.get());
+
+    target.post([&target, moved]()
+                { target.add_connection(moved); });
+}
+
+void EventLoop::add_connection(const ConnectionPtr &conn)
+{
+    connections.emplace(conn.get(), conn);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn.get();
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close_connection(conn);
+        return;
+    }
+
+    if (conn->state != ConnState::WebSocket)
+        touch(*conn);
+    else if (heartbeat.interval.count() > 0)
+        schedule_heartbeat(conn, conn->lastActive + heartbeat.interval);
+
+    // finish whatever the previous owner handed over with the socket
+    resume_client_connection(conn);
+}
+
+void EventLoop::register_pending()
+{
+    uint64_t count;
+    while (read(wakeFd, &count, sizeof(count)) > 0)
+    {
+    }
+
+    std::vector<int> fds;
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        fds.swap(pendingFds);
+        tasks.swap(pendingTasks);
+    }
+
+    for (int fd : fds)
+        add_socket(fd);
+    for (auto &task : tasks)
+        task();
+    run_work();
+}
+
+void EventLoop::add_socket(int fd)
+{
+    auto conn = std::make_shared<Connection>(fd, this);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn.get();
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(fd);
+        return;
+    }
+    touch(*conn);
+    connections.emplace(conn.get(), std::move(conn));
+}
+
+void EventLoop::run(int cpu)
+{
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            std::fprintf(stderr, "[EventLoop] Could not pin to CPU %d\n", cpu);
+    }
+
+    epoll_event events[MAX_EVENTS];
+
+    while (true)
+    {
+        // wake up once a second while there are idle or heartbeat deadlines to enforce
+        int timeoutMs = idleList.empty() && heartbeats.size() == 0 ? -1 : 1000;
+        if (heartbeatBacklog || workBacklog)
+            timeoutMs = 0;
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.ptr == nullptr)
+            {
+                register_pending();
+                continue;
+            }
+            if (events[i].data.ptr == &listenFd)
+            {
+                accept_pending();
+                continue;
+            }
+
+            auto it = connections.find(static_cast<Connection *>(events[i].data.ptr));
+            if (it == connections.end())
+                continue;
+            ConnectionPtr conn = it->second;
+            uint32_t ev = events[i].events;
+
+            if (ev & EPOLLOUT)
+            {
+                std::lock_guard<std::mutex> lock(conn->outMutex);
+                conn->flush_locked();
+            }
+            if (conn->readPaused && (ev & (EPOLLHUP | EPOLLERR)))
+            {
+                close_connection(conn); // gone for good; what it left unread does not matter
+                continue;
+            }
+            // output draining may be what a paused connection was waiting for
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) || (conn->readPaused && (ev & EPOLLOUT)))
+            {
+                on_readable(conn);
+            }
+        }
+
+        if (workBacklog)
+            run_work();
+        reap_idle();
+        run_heartbeats();
+    }
+}
+
+void EventLoop::resume_input(const ConnectionPtr &conn)
+{
+    // loop first: after a hand_off, fd belongs to the new owner's thread
+    if (conn->loop != this || conn->fd < 0 || !connections.count(conn.get()))
+        return;
+    if (conn->readPaused)
+        on_readable(conn);
+    else
+        sync_input(*conn); // what a remote answer let through has been handled
+}
+
+/*
+Edge-triggered: drain the socket, unless the connection already holds as
+much unanswered input as it may, is waiting for another loop to answer a
+request, or its client is not reading its output.
+Then the rest stays in the kernel (and TCP pushes back on the client) and
+readPaused is set; resume_input reads on once the input has been handled,
+and an EPOLLOUT edge does once the output has drained. */
+void EventLoop::on_readable(const ConnectionPtr &conn)
+{
+    bool eof = false;
+    bool received = false;
+    const std::size_t limit = max_pending_input(*conn);
+    conn->readPaused = conn->awaitingRemote || conn->output_backlogged();
+    char buf[16384];
+    while (!conn->readPaused)
+    {
+        if (conn->inbuf.size() >= limit)
+        {
+            conn->readPaused = true;
+            break;
+        }
+        ssize_t n = recv(conn->fd, buf, std::min(sizeof(buf), limit - conn->inbuf.size()), 0);
+        if (n > 0)
+        {
+            conn->inbuf.append(buf, static_cast<std::size_t>(n));
+            received = true;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        eof = true;
+        break;
+    }
+
+    // a client that is only being held off is not active
+    if (received || eof)
+    {
+        if (conn->state != ConnState::WebSocket)
+            touch(*conn);
+        else
+            conn->lastActive = std::chrono::steady_clock::now(); // answers any outstanding ping
+    }
+
+    // counted before it is handled, so this loop's own requests see it in admits
+    sync_input(*conn);
+    if (!conn->inbuf.empty())
+        handle_client_connection(conn);
+
+    // subscribed to a match another loop owns; that loop has the socket now
+    if (conn->loop != this)
+        return;
+    sync_input(*conn);
+
+    // stopped at the input limit and the input has since been handled: read on,
+    // after the other sockets ready now have had their turn
+    if (conn->readPaused && !eof && conn->inbuf.size() < limit && !conn->awaitingRemote &&
+        !conn->output_backlogged())
+    {
+        ConnectionPtr paused = conn;
+        post([this, paused]()
+             { resume_input(paused); });
+    }
+
+    // upgraded sockets are long-lived and no longer subject to the HTTP idle timeout
+    if (conn->state == ConnState::WebSocket)
+    {
+        untrack(*conn);
+        if (!conn->heartbeatScheduled && heartbeat.interval.count() > 0)
+            schedule_heartbeat(conn, conn->lastActive + heartbeat.interval);
+    }
+
+    if (eof)
+        close_connection(conn);
+}
+
+void EventLoop::close_connection(const ConnectionPtr &conn)
+{
+    handle_client_disconnect(conn);
+    untrack(*conn);
+    bufferedInput.fetch_sub(conn->accountedInput, std::memory_order_relaxed);
+    conn->accountedInput = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(conn->outMutex);
+        conn->closed = true;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    connections.erase(conn.get());
+}
+
+void EventLoop::touch(Connection &conn)
+{
+    conn.lastActive = std::chrono::steady_clock::now();
+    if (conn.idleTracked)
+        idleList.splice(idleList.end(), idleList, conn.idleIt);
+    else
+        conn.idleIt = idleList.insert(idleList.end(), &conn);
+    conn.idleTracked = true;
+}
+
+void EventLoop::untrack(Connection &conn)
+{
+    if (!conn.idleTracked)
+        return;
+    idleList.erase(conn.idleIt);
+    conn.idleTracked = false;
+}
+
+void EventLoop::reap_idle()
+{
+    auto deadline = std::chrono::steady_clock::now() - HTTP_IDLE_TIMEOUT;
+    while (!idleList.empty() && idleList.front()->lastActive < deadline)
+    {
+        auto it = connections.find(idleList.front());
+        if (it == connections.end())
+        {
+            idleList.pop_front();
+            continue;
+        }
+        close_connection(ConnectionPtr(it->second));
+    }
+}
+
+void EventLoop::schedule_heartbeat(const ConnectionPtr &conn, std::chrono::steady_clock::time_point deadline)
+{
+    conn->heartbeatScheduled = true;
+    heartbeats.schedule(deadline, conn);
+}
+
+void EventLoop::check_heartbeat(const ConnectionPtr &conn, std::chrono::steady_clock::time_point now)
+{
+    conn->heartbeatScheduled = false;
+    if (conn->state != ConnState::WebSocket)
+        return; // closing; the socket goes away on its own
+
+    if (conn->pingOutstanding)
+    {
+        if (conn->lastActive > conn->pingSent)
+        {
+            conn->pingOutstanding = false;
+        }
+        else if (now - conn->pingSent >= heartbeat.timeout)
+        {
+            metrics::websocketHeartbeatTimeouts.add();
+            close_connection(conn); // half-open or hopelessly stalled
+            return;
+        }
+        else
+        {
+            schedule_heartbeat(conn, conn->pingSent + heartbeat.timeout);
+            return;
+        }
+    }
+
+    if (now - conn->lastActive < heartbeat.interval)
+    {
+        schedule_heartbeat(conn, conn->lastActive + heartbeat.interval);
+        return;
+    }
+
+    // empty pings are identical, so every connection shares one frame
+    static const WsOutFrame ping = make_ws_frame(WS_OPCODE_PING, std::string());
+    send_ws_frame(*conn, ping);
+    conn->pingSent = now;
+    conn->pingOutstanding = true;
+    schedule_heartbeat(conn, now + heartbeat.timeout);
+}
+
+void EventLoop::run_heartbeats()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::size_t done = heartbeats.advance(now, HEARTBEAT_BATCH, [&](std::weak_ptr<Connection> weak)
+                                          {
+        // entries of closed sockets simply lapse, and so do those of sockets handed
+        // to another loop; loop is tested first, since only the owner may read fd
+        if (ConnectionPtr conn = weak.lock())
+        {
+            if (conn->loop == this && conn->fd >= 0)
+                check_heartbeat(conn, now);
+        } });
+    heartbeatBacklog = done == HEARTBEAT_BATCH;
+}
@@ -1,19 +1,36 @@
 #include "../include/http.hpp"
 
 #include <sstream>
+#include <charconv>
 
-std::string url_decode(const std::string &s)
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+std::string url_decode(std::string_view s)
 {
     std::string out;
+    out.reserve(s.size());
     for (std::size_t i = 0; i < s.size(); ++i)
     {
         if (s[i] == '%' && i + 2 < s.size())
         {
-            int v = 0;
-            std::istringstream iss(s.substr(i + 1, 2));
-            iss >> std::hex >> v;
-            out.push_back(static_cast<char>(v));
-            i += 2;
+            int hi = hex_value(s[i + 1]);
+            int lo = hi < 0 ? -1 : hex_value(s[i + 2]);
+            if (lo >= 0)
+            {
+                out.push_back(static_cast<char>(hi << 4 | lo));
+                i += 2;
+                continue;
+            }
+            out.push_back('%'); // not an escape, keep it literally
         }
         else if (s[i] == '+')
         {
@@ -27,61 +44,239 @@ std::string url_decode(const std::string &s)
     return out;
 }
 
-std::string get_query_param(const std::string &query, const std::string &key)
+QueryParams::QueryParams(std::string_view query)
+{
+    while (!query.empty() && count < MAX_PARAMS)
+    {
+        std::size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+        if (pair.empty())
+            continue;
+
+        std::size_t eq = pair.find('=');
+        params[count].key = pair.substr(0, eq);
+        params[count].value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+        ++count;
+    }
+}
+
+bool QueryParams::find(std::string_view key, std::string_view &raw) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (params[i].key == key)
+        {
+            raw = params[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string QueryParams::get(std::string_view key) const
 {
-    std::string pattern = key + "=";
-    std::size_t pos = query.find(pattern);
-    if (pos == std::string::npos)
+    std::string_view raw;
+    if (!find(key, raw))
         return "";
-    pos += pattern.size();
-    std::size_t end = query.find("&", pos);
-    std::string val = query.substr(
-        pos,
-        end == std::string::npos ? std::string::npos : end - pos);
-    return url_decode(val);
+    if (raw.find_first_of("%+") == std::string_view::npos)
+        return std::string(raw);
+    return url_decode(raw);
 }
 
-bool parse_http_request(const std::string &raw, HttpRequest &out)
+bool QueryParams::get_int(std::string_view key, int &out) const
 {
-    std::size_t lineEnd = raw.find("\r\n");
-    if (lineEnd == std::string::npos)
+    std::string_view raw;
+    if (!find(key, raw) || raw.empty())
         return false;
-    std::string firstLine = raw.substr(0, lineEnd);
 
-    std::istringstream iss(firstLine);
-    std::string method, uri, version;
-    if (!(iss >> method >> uri >> version))
+    std::string decoded;
+    if (raw.find('%') != std::string_view::npos)
+    {
+        decoded = url_decode(raw);
+        raw = decoded;
+    }
+
+    int value = 0;
+    auto res = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    if (res.ec != std::errc() || res.ptr != raw.data() + raw.size())
         return false;
+    out = value;
+    return true;
+}
 
-    out.method = method;
+std::string get_query_param(std::string_view query, std::string_view key)
+{
+    return QueryParams(query).get(key);
+}
 
-    std::size_t qPos = uri.find("?");
-    if (qPos == std::string::npos)
+static char lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Case-insensitive compare against a lowercase literal
+static bool iequals(std::string_view a, std::string_view lowerB)
+{
+    if (a.size() != lowerB.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); ++i)
     {
-        out.path = uri;
-        out.query = "";
+        if (lower(a[i]) != lowerB[i])
+            return false;
     }
-    else
+    return true;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Does a comma separated header value contain token (case-insensitive)?
+static bool has_token(std::string_view value, std::string_view lowerToken)
+{
+    while (!value.empty())
+    {
+        std::size_t comma = value.find(',');
+        if (iequals(trim(value.substr(0, comma)), lowerToken))
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool parse_http_request(std::string_view head, HttpRequest &out)
+{
+    std::size_t lineEnd = head.find("\r\n");
+    std::string_view line = head.substr(0, lineEnd);
+
+    // METHOD SP URI SP HTTP/1.x
+    std::size_t sp1 = line.find(' ');
+    if (sp1 == std::string_view::npos || sp1 == 0)
+        return false;
+    std::size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp2 == sp1 + 1)
+        return false;
+    std::string_view version = line.substr(sp2 + 1);
+    if (version.size() != 8 || version.substr(0, 7) != "HTTP/1." ||
+        version[7] < '0' || version[7] > '9')
+        return false;
+
+    out.method = line.substr(0, sp1);
+    out.versionMinor = version[7] - '0';
+
+    std::string_view uri = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::size_t qPos = uri.find('?');
+    out.path = uri.substr(0, qPos);
+    out.query = qPos == std::string_view::npos ? std::string_view() : uri.substr(qPos + 1);
+
+    // HTTP/1.1 persists by default, HTTP/1.0 only when asked to
+    bool closeRequested = false;
+    bool keepAliveRequested = false;
+    out.contentLength = 0;
+    out.upgradeWebsocket = false;
+    out.connectionUpgrade = false;
+    out.secWebSocketKey = std::string_view();
+    out.secWebSocketExtensions = std::string_view();
+
+    std::size_t pos = lineEnd == std::string_view::npos ? head.size() : lineEnd + 2;
+    while (pos < head.size())
     {
-        out.path = uri.substr(0, qPos);
-        out.query = uri.substr(qPos + 1);
+        std::size_t end = head.find("\r\n", pos);
+        if (end == std::string_view::npos)
+            end = head.size();
+        line = head.substr(pos, end - pos);
+        pos = end + 2;
+        if (line.empty())
+            break;
+
+        std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+        std::string_view name = trim(line.substr(0, colon));
+        std::string_view value = trim(line.substr(colon + 1));
+
+        // only the headers we act on; the length check skips most others cheaply
+        switch (name.size())
+        {
+        case 7:
+            if (iequals(name, "upgrade"))
+                out.upgradeWebsocket = has_token(value, "websocket");
+            break;
+        case 10:
+            if (iequals(name, "connection"))
+            {
+                closeRequested = has_token(value, "close");
+                keepAliveRequested = has_token(value, "keep-alive");
+                out.connectionUpgrade = has_token(value, "upgrade");
+            }
+            break;
+        case 14:
+            if (iequals(name, "content-length"))
+            {
+                auto res = std::from_chars(value.data(), value.data() + value.size(), out.contentLength);
+                if (res.ec != std::errc() || res.ptr != value.data() + value.size())
+                    return false;
+            }
+            break;
+        case 17:
+            if (iequals(name, "sec-websocket-key"))
+                out.secWebSocketKey = value;
+            break;
+        case 24:
+            if (iequals(name, "sec-websocket-extensions"))
+                out.secWebSocketExtensions = value;
+            break;
+        }
     }
+
+    out.keepAlive = out.versionMinor >= 1 ? !closeRequested : keepAliveRequested;
     return true;
 }
 
+HttpParseStatus HttpParser::parse(std::string_view buf, HttpRequest &out)
+{
+    if (headSize == 0)
+    {
+        // the blank line may straddle the previous read boundary
+        std::size_t from = scanned >= 3 ? scanned - 3 : 0;
+        std::size_t end = buf.find("\r\n\r\n", from);
+        if (end == std::string_view::npos)
+        {
+            scanned = buf.size();
+            return HttpParseStatus::Incomplete;
+        }
+        headSize = end + 4;
+    }
+
+    return parse_http_request(buf.substr(0, headSize - 2), out)
+               ? HttpParseStatus::Complete
+               : HttpParseStatus::Error;
+}
+
 std::string make_http_response(const std::string &body,
                                const std::string &contentType,
                                int statusCode,
-                               const std::string &statusText)
+                               const std::string &statusText,
+                               bool keepAlive,
+                               const std::string &extraHeaders)
 {
     std::ostringstream oss;
     oss << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
     oss << "Content-Type: " << contentType << "\r\n";
     oss << "Content-Length: " << body.size() << "\r\n";
-    oss << "Connection: close\r\n";
+    oss << (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
     oss << "Access-Control-Allow-Origin: *\r\n";
     oss << "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
     oss << "Access-Control-Allow-Headers: Content-Type\r\n";
+    oss << extraHeaders;
     oss << "\r\n";
     oss << body;
     return oss.str();
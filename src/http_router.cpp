@@ -3,71 +3,279 @@
 #include "../include/websockets.hpp"
 #include "../include/match.hpp"
 #include "../include/match_http.hpp"
+#include "../include/metrics.hpp"
+#include "../include/event_loop.hpp"
 
 #include <unistd.h>
 #include <string>
 #include <sstream>
 
-void handle_client_connection(int client_fd)
+// Largest request head we are willing to buffer
+static const std::size_t MAX_REQUEST_BYTES = 8192;
+// Unanswered pipelined requests buffered per connection; reading waits beyond this
+static const std::size_t MAX_PENDING_REQUEST_BYTES = 4 * MAX_REQUEST_BYTES;
+// Persistent connections are closed after this many requests
+static const unsigned MAX_REQUESTS_PER_CONNECTION = 1000;
+
+// Status code of a response built by make_http_response ("HTTP/1.1 200 ...")
+static int response_status(const std::string &resp)
 {
-    char buffer[4096];
-    int bytes = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (bytes <= 0)
-    {
-        close(client_fd);
-        return;
-    }
-    buffer[bytes] = '\0';
-    std::string raw(buffer);
+    if (resp.size() < 12)
+        return 0;
+    return (resp[9] - '0') * 100 + (resp[10] - '0') * 10 + (resp[11] - '0');
+}
 
-    HttpRequest req;
-    if (!parse_http_request(raw, req))
-    {
-        std::string resp = make_http_response(
-            "Bad Request\n", "text/plain", 400, "Bad Request");
-        send(client_fd, resp.c_str(), resp.size(), 0);
-        close(client_fd);
-        return;
-    }
+static void reply_and_close(const ConnectionPtr &conn, const std::string &resp)
+{
+    conn->state = ConnState::Closing;
+    conn->inbuf.clear();
+    conn->send(resp);
+    conn->close_after_flush();
+}
+
+static bool names_match(metrics::HttpRoute route)
+{
+    return route == metrics::HttpRoute::State || route == metrics::HttpRoute::Action ||
+           route == metrics::HttpRoute::Join || route == metrics::HttpRoute::Egress;
+}
+
+// captains must not wait behind spectators polling the same loop (or anyone reading stats)
+static WorkPriority work_priority(metrics::HttpRoute route)
+{
+    return route == metrics::HttpRoute::State || route == metrics::HttpRoute::Egress ? WorkPriority::Low
+                                                                                      : WorkPriority::High;
+}
+
+// The loop that owns the match a request names, if that is not the connection's own loop
+static EventLoop *remote_owner(const ConnectionPtr &conn, metrics::HttpRoute route, const HttpRequest &req)
+{
+    if (!names_match(route))
+        return nullptr;
+    EventLoop *owner = EventLoop::owner_of(QueryParams(req.query).get("id"));
+    return owner == conn->loop ? nullptr : owner;
+}
+
+// Sent instead of queueing work for a loop that is already too far behind
+static std::string overloaded_response(bool keepAlive)
+{
+    return make_http_response("Server busy\n", "text/plain", 503, "Service Unavailable", keepAlive,
+                              "Retry-After: 1\r\n");
+}
 
-    if (req.method == "OPTIONS")
+/*
+Answer a request on the loop that owns its match. The head is re-parsed
+from a copy there; the response is queued from that thread (send is
+thread-safe) and the connection's own loop then resumes with whatever
+was pipelined behind the request. False if the owner's queue for this
+route's priority is full and nothing was queued. */
+static bool answer_on_owner(const ConnectionPtr &conn, EventLoop &owner, std::string head,
+                            bool keepAlive, metrics::HttpRoute route)
+{
+    EventLoop *home = conn->loop;
+    return owner.submit(work_priority(route), [conn, home, head = std::move(head), keepAlive, route]()
+                        {
+        HttpRequest req;
+        parse_http_request(head, req); // cannot fail, it parsed once already
+        req.keepAlive = keepAlive;
+
+        const std::uint64_t start = metrics::now_ns();
+        std::string resp = handle_match_http(req);
+        metrics::record_http_request(route, response_status(resp), metrics::now_ns() - start);
+        conn->send(std::move(resp));
+        if (!keepAlive)
+            conn->close_after_flush();
+
+        home->post([conn]()
+                   { resume_client_connection(conn); }); });
+}
+
+// Upgrade to a WebSocket; the handshake request has already been consumed
+static void upgrade_websocket(const ConnectionPtr &conn, const std::string &acceptKey, bool deflate)
+{
+    std::ostringstream hs;
+    hs << "HTTP/1.1 101 Switching Protocols\r\n"
+       << "Upgrade: websocket\r\n"
+       << "Connection: Upgrade\r\n"
+       << "Sec-WebSocket-Accept: " << acceptKey << "\r\n";
+    if (deflate)
+        hs << "Sec-WebSocket-Extensions: " << permessage_deflate_response(conn->wsDeflateParams) << "\r\n";
+    hs << "\r\n";
+    conn->send(hs.str());
+    conn->wsDeflate = deflate;
+    metrics::record_http_request(metrics::HttpRoute::WebSocket, 101, 0);
+    metrics::websocketClients.add(1);
+
+    // anything after the handshake already belongs to the WebSocket stream
+    conn->state = ConnState::WebSocket;
+    if (!conn->inbuf.empty())
+        handle_websocket_client(conn);
+}
+
+void handle_client_connection(const ConnectionPtr &conn)
+{
+    if (conn->state == ConnState::WebSocket)
     {
-        // return empty 204 with CORS headers
-        std::string resp = make_http_response("", "text/plain", 204, "No Content");
-        send(client_fd, resp.c_str(), resp.size(), 0);
-        close(client_fd);
+        handle_websocket_client(conn);
         return;
     }
-    // WebSocket upgrade
-    if (req.method == "GET" && req.path == "/ws")
+    if (conn->awaitingRemote)
+        return; // responses must go out in order; resume_client_connection picks this up
+                // and the loop reads no more of the socket until then
+
+    // Answer every complete request in the buffer, in order (pipelining).
+    // Requests are parsed in place; consumed bytes are dropped once at the end.
+    std::size_t offset = 0;
+    while (conn->state == ConnState::Http)
     {
-        std::string secKey;
-        if (!is_websocket_upgrade(raw, secKey))
+        // the rest waits in inbuf until the client reads what it has been sent;
+        // the loop picks it up again on the EPOLLOUT that drains the backlog
+        if (conn->output_backlogged())
+        {
+            conn->readPaused = true;
+            break;
+        }
+
+        std::string_view buf(conn->inbuf);
+        buf.remove_prefix(offset);
+
+        HttpRequest req;
+        HttpParseStatus st = conn->parser.parse(buf, req);
+        if (st == HttpParseStatus::Incomplete)
+        {
+            if (buf.size() > MAX_REQUEST_BYTES)
+            {
+                metrics::record_http_request(metrics::HttpRoute::Other, 400, 0);
+                reply_and_close(conn, make_http_response(
+                                          "Bad Request\n", "text/plain", 400, "Bad Request"));
+                return;
+            }
+            break; // wait for the rest of the head
+        }
+        if (st == HttpParseStatus::Error)
         {
-            std::string resp = make_http_response(
-                "Bad WS upgrade\n", "text/plain", 400, "Bad Request");
-            send(client_fd, resp.c_str(), resp.size(), 0);
-            close(client_fd);
+            metrics::record_http_request(metrics::HttpRoute::Other, 400, 0);
+            reply_and_close(conn, make_http_response(
+                                      "Bad Request\n", "text/plain", 400, "Bad Request"));
             return;
         }
 
-        std::string acceptKey = compute_websocket_accept(secKey);
+        // request bodies are not used by any endpoint, but must be skipped
+        const metrics::HttpRoute route = metrics::http_route(req.path);
+        if (req.contentLength > MAX_REQUEST_BYTES)
+        {
+            metrics::record_http_request(route, 413, 0);
+            reply_and_close(conn, make_http_response(
+                                      "Payload Too Large\n", "text/plain", 413, "Payload Too Large"));
+            return;
+        }
+        std::size_t total = conn->parser.head_size() + req.contentLength;
+        if (buf.size() < total)
+            break;
 
-        std::ostringstream hs;
-        hs << "HTTP/1.1 101 Switching Protocols\r\n"
-           << "Upgrade: websocket\r\n"
-           << "Connection: Upgrade\r\n"
-           << "Sec-WebSocket-Accept: " << acceptKey << "\r\n"
-           << "\r\n";
-        std::string handshake = hs.str();
-        send(client_fd, handshake.c_str(), handshake.size(), 0);
+        // WebSocket upgrade
+        if (req.method == "GET" && req.path == "/ws")
+        {
+            if (!is_websocket_upgrade(req))
+            {
+                metrics::record_http_request(route, 400, 0);
+                reply_and_close(conn, make_http_response(
+                                          "Bad WS upgrade\n", "text/plain", 400, "Bad Request"));
+                return;
+            }
+            // req points into inbuf, so read everything needed before erasing it
+            std::string acceptKey = compute_websocket_accept(req.secWebSocketKey);
+            bool deflate = negotiate_permessage_deflate(req.secWebSocketExtensions, conn->wsDeflateParams);
+            conn->inbuf.erase(0, offset + total);
+            conn->parser.reset();
+            upgrade_websocket(conn, acceptKey, deflate);
+            return;
+        }
 
-        handle_websocket_client(client_fd);
-        return;
+        if (++conn->requestsServed >= MAX_REQUESTS_PER_CONNECTION)
+            req.keepAlive = false;
+
+        // requests naming a match are answered by the loop that owns it; one
+        // for this loop's own match is answered inline, but only while this
+        // loop would still accept the same work from another loop
+        EventLoop *owner = remote_owner(conn, route, req);
+        const bool keepAlive = req.keepAlive;
+        bool admitted = true;
+        if (owner)
+        {
+            std::string head(buf.substr(0, conn->parser.head_size() - 2));
+            offset += total;
+            conn->parser.reset();
+            if (answer_on_owner(conn, *owner, std::move(head), keepAlive, route))
+            {
+                conn->awaitingRemote = true;
+                if (!keepAlive)
+                    conn->state = ConnState::Closing;
+                break;
+            }
+            admitted = false;
+        }
+        else if (names_match(route) && !conn->loop->admits(work_priority(route)))
+        {
+            offset += total;
+            conn->parser.reset();
+            admitted = false;
+        }
+        if (!admitted)
+        {
+            // the owner is saturated: fail fast instead of queueing without bound
+            metrics::record_http_request(route, 503, 0);
+            if (!keepAlive)
+            {
+                reply_and_close(conn, overloaded_response(false));
+                return;
+            }
+            conn->send(overloaded_response(true));
+            continue;
+        }
+
+        // normal HTTP (OPTIONS preflight is answered there too)
+        const std::uint64_t start = metrics::now_ns();
+        std::string resp = handle_match_http(req);
+        metrics::record_http_request(route, response_status(resp), metrics::now_ns() - start);
+        offset += total;
+        conn->parser.reset();
+        if (!req.keepAlive)
+        {
+            reply_and_close(conn, resp);
+            return;
+        }
+        conn->send(std::move(resp));
     }
 
-    // normal HTTP
-    std::string resp = handle_match_http(req);
-    send(client_fd, resp.c_str(), resp.size(), 0);
-    close(client_fd);
+    if (conn->state == ConnState::Closing)
+        conn->inbuf.clear(); // input after the final response is discarded
+    else
+        conn->inbuf.erase(0, offset);
+}
+
+void resume_client_connection(const ConnectionPtr &conn)
+{
+    conn->awaitingRemote = false;
+    if (conn->fd >= 0 && conn->state != ConnState::Closing)
+        handle_client_connection(conn);
+    // input may have stopped at its limit while the answer was on its way
+    if (conn->loop)
+        conn->loop->resume_input(conn);
+}
+
+std::size_t max_pending_input(const Connection &conn)
+{
+    // a WebSocket frame is only handled once all of it has arrived
+    if (conn.state == ConnState::WebSocket)
+        return 2 * MAX_WS_MESSAGE_BYTES;
+    return MAX_PENDING_REQUEST_BYTES;
+}
+
+void handle_client_disconnect(const ConnectionPtr &conn)
+{
+    if (conn->state == ConnState::WebSocket)
+    {
+        metrics::websocketClients.add(-1);
+        remove_websocket_client(conn);
+    }
 }
@@ -0,0 +1,741 @@
+#include "../include/journal.hpp"
+#include "../include/veto_format.hpp"
+#include "../include/snapshot.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pb
+{
+    enum class RecordType : std::uint8_t
+    {
+        Match = 1, // upsert of the whole match
+        Claim = 2,
+        Action = 3,
+        Expire = 4
+    };
+
+    static const std::size_t RECORD_HEADER = 8;           // length + crc
+    static const std::uint32_t MAX_RECORD = 1u << 20;     // anything larger is corruption
+    static const std::uint64_t COMPACT_MIN_BYTES = 64ull << 20;
+    static const std::chrono::minutes SNAPSHOT_INTERVAL{5};
+
+    static std::uint32_t crc32(const char *data, std::size_t len)
+    {
+        static const auto table = []()
+        {
+            struct Table
+            {
+                std::uint32_t v[256];
+            } t;
+            for (std::uint32_t i = 0; i < 256; ++i)
+            {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t.v[i] = c;
+            }
+            return t;
+        }();
+
+        std::uint32_t c = 0xFFFFFFFFu;
+        for (std::size_t i = 0; i < len; ++i)
+            c = table.v[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+        return c ^ 0xFFFFFFFFu;
+    }
+
+    // Little-endian record encoding (the host byte order on every target we run on)
+    class RecordWriter
+    {
+    public:
+        explicit RecordWriter(std::string &out) : out(out) {}
+
+        template <class Int>
+        void integer(Int v) { out.append(reinterpret_cast<const char *>(&v), sizeof(v)); }
+        void string(const std::string &s)
+        {
+            integer(static_cast<std::uint32_t>(s.size()));
+            out.append(s);
+        }
+        void int_array(const std::vector<int> &v)
+        {
+            integer(static_cast<std::uint32_t>(v.size()));
+            for (int x : v)
+                integer(static_cast<std::int32_t>(x));
+        }
+
+    private:
+        std::string &out;
+    };
+
+    // Bounds-checked reader; any overrun latches ok = false
+    class RecordReader
+    {
+    public:
+        RecordReader(const char *data, std::size_t len) : p(data), end(data + len) {}
+
+        template <class Int>
+        Int integer()
+        {
+            Int v{};
+            if (static_cast<std::size_t>(end - p) < sizeof(v))
+            {
+                ok = false;
+                return v;
+            }
+            std::memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            return v;
+        }
+        std::string string()
+        {
+            std::uint32_t n = integer<std::uint32_t>();
+            if (!ok || static_cast<std::size_t>(end - p) < n)
+            {
+                ok = false;
+                return std::string();
+            }
+            std::string s(p, n);
+            p += n;
+            return s;
+        }
+        std::vector<int> int_array()
+        {
+            std::uint32_t n = integer<std::uint32_t>();
+            if (!ok || static_cast<std::size_t>(end - p) / 4 < n)
+            {
+                ok = false;
+                return {};
+            }
+            std::vector<int> v(n);
+            for (auto &x : v)
+                x = integer<std::int32_t>();
+            return v;
+        }
+
+        bool ok = true;
+
+    private:
+        const char *p;
+        const char *end;
+    };
+
+    static void encode_match(RecordWriter &w, const Match &m)
+    {
+        w.string(m.id);
+        w.string(m.format->name);
+        w.integer(static_cast<std::uint8_t>(m.phase));
+        w.integer(static_cast<std::int32_t>(m.currentTurnTeam));
+        w.integer(static_cast<std::uint32_t>(m.currentStepIndex));
+        w.integer(static_cast<std::uint64_t>(m.version));
+        for (const Team &team : m.teams)
+        {
+            w.string(team.name);
+            w.int_array(team.bannedMapIds);
+            w.int_array(team.pickedMapIds);
+        }
+        w.string(m.teamCaptainTokens[0]);
+        w.string(m.teamCaptainTokens[1]);
+        w.integer(static_cast<std::int32_t>(m.deciderSide));
+        w.integer(static_cast<std::int32_t>(m.deciderSidePickerTeam));
+        w.integer(static_cast<std::int32_t>(m.deciderMapId));
+        w.integer(static_cast<std::int32_t>(m.currentSideMapId));
+        w.integer(static_cast<std::uint32_t>(m.mapSides.size()));
+        for (const auto &side : m.mapSides)
+        {
+            w.integer(static_cast<std::int32_t>(side.first));
+            w.integer(static_cast<std::int32_t>(side.second));
+        }
+        w.int_array(m.stepMapIds);
+        w.int_array(m.stepSideVals);
+    }
+
+    static bool decode_match(RecordReader &r, Match &m)
+    {
+        m.id = r.string();
+        std::string formatName = r.string();
+        std::uint8_t phase = r.integer<std::uint8_t>();
+        m.currentTurnTeam = r.integer<std::int32_t>();
+        m.currentStepIndex = r.integer<std::uint32_t>();
+        m.version = r.integer<std::uint64_t>();
+        for (Team &team : m.teams)
+        {
+            team.name = r.string();
+            team.bannedMapIds = r.int_array();
+            team.pickedMapIds = r.int_array();
+        }
+        m.teamCaptainTokens[0] = r.string();
+        m.teamCaptainTokens[1] = r.string();
+        m.deciderSide = r.integer<std::int32_t>();
+        m.deciderSidePickerTeam = r.integer<std::int32_t>();
+        m.deciderMapId = r.integer<std::int32_t>();
+        m.currentSideMapId = r.integer<std::int32_t>();
+        std::uint32_t sides = r.integer<std::uint32_t>();
+        for (std::uint32_t i = 0; i < sides && r.ok; ++i)
+        {
+            int mapId = r.integer<std::int32_t>();
+            m.mapSides[mapId] = r.integer<std::int32_t>();
+        }
+        m.stepMapIds = r.int_array();
+        m.stepSideVals = r.int_array();
+        if (!r.ok || phase > static_cast<std::uint8_t>(Phase::Completed))
+            return false;
+
+        m.format = find_veto_format(formatName);
+        if (!m.format)
+        {
+            std::cerr << "[Journal] Match " << m.id << " uses unknown format " << formatName << std::endl;
+            return false;
+        }
+        const std::size_t steps = m.format->steps.size();
+        if (m.currentStepIndex > steps || m.stepMapIds.size() != steps || m.stepSideVals.size() != steps)
+            return false;
+
+        m.phase = static_cast<Phase>(phase);
+        // replayed matches use the current pool; ids are stable across reloads
+        m.catalog = current_map_catalog();
+        return true;
+    }
+
+    // Appends and the writer thread that makes them durable
+    struct Journal
+    {
+        std::mutex mutex;
+        std::condition_variable wake;    // writer: records pending or stop requested
+        std::condition_variable drained; // waiters: durable advanced or writer idle
+
+        bool open = false;
+        bool stop = false;
+        bool writing = false;
+        bool failed = false; // a write or fdatasync failed; durable stops advancing
+        std::string dir;
+        int fd = -1;
+        std::uint64_t generation = 0;
+
+        std::string pending;
+        std::uint64_t appended = 0; // bytes handed to append()
+        std::uint64_t durable = 0;  // bytes written and fdatasync'ed
+
+        std::uint64_t segmentBytes = 0; // across every segment on disk
+        std::uint64_t liveBytes = 0;    // size of the last snapshot
+        std::chrono::steady_clock::time_point lastCompaction = std::chrono::steady_clock::now();
+
+        std::thread writer;
+    };
+    static Journal g_journal;
+
+    // Serializes compactions with each other and with close_journal
+    static std::mutex g_compactMutex;
+
+    static std::string snapshot_path(const std::string &dir)
+    {
+        return dir + "/snapshot.bin";
+    }
+
+    static std::string segment_path(const std::string &dir, std::uint64_t generation)
+    {
+        return dir + "/journal-" + std::to_string(generation) + ".log";
+    }
+
+    // Generations of the segments in dir, ascending
+    static std::vector<std::uint64_t> list_segments(const std::string &dir)
+    {
+        std::vector<std::uint64_t> gens;
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            return gens;
+        while (dirent *e = readdir(d))
+        {
+            // journal-<generation>.log
+            if (std::strncmp(e->d_name, "journal-", 8) != 0)
+                continue;
+            char *end = nullptr;
+            unsigned long long gen = std::strtoull(e->d_name + 8, &end, 10);
+            if (end != e->d_name + 8 && std::strcmp(end, ".log") == 0)
+                gens.push_back(gen);
+        }
+        closedir(d);
+        std::sort(gens.begin(), gens.end());
+        return gens;
+    }
+
+    static void sync_dir(const std::string &dir)
+    {
+        int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0)
+        {
+            fsync(dfd);
+            ::close(dfd);
+        }
+    }
+
+    static bool write_all(int fd, const std::string &data)
+    {
+        std::size_t off = 0;
+        while (off < data.size())
+        {
+            ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            off += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    static bool read_file(const std::string &path, std::string &out)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            out.reserve(static_cast<std::size_t>(st.st_size));
+        char buf[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) != 0)
+        {
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ::close(fd);
+                return false;
+            }
+            out.append(buf, static_cast<std::size_t>(n));
+        }
+        ::close(fd);
+        return true;
+    }
+
+    static void writer_loop()
+    {
+        Journal &j = g_journal;
+        std::string batch;
+        std::unique_lock<std::mutex> lock(j.mutex);
+
+        while (true)
+        {
+            j.wake.wait(lock, [&]()
+                        { return j.stop || !j.pending.empty(); });
+            if (j.pending.empty())
+                break; // stop requested and nothing left
+
+            // everything that piled up during the last fdatasync goes out together
+            batch.clear();
+            batch.swap(j.pending);
+            int fd = j.fd;
+            j.writing = true;
+            lock.unlock();
+
+            const bool ok = write_all(fd, batch) && fdatasync(fd) == 0;
+            if (!ok)
+                perror("[Journal] write");
+
+            lock.lock();
+            j.writing = false;
+            if (ok)
+            {
+                j.durable += batch.size();
+                j.segmentBytes += batch.size();
+            }
+            else
+            {
+                // the segment may end in a partial batch; stop rather than pile records after it
+                j.failed = true;
+                j.pending.clear();
+                std::cerr << "[Journal] Journal failed; changes are refused until restart" << std::endl;
+            }
+            j.drained.notify_all();
+        }
+    }
+
+    static void append(RecordType type, const std::string &payload)
+    {
+        std::string body;
+        body.reserve(1 + payload.size());
+        body.push_back(static_cast<char>(type));
+        body.append(payload);
+
+        std::uint32_t len = static_cast<std::uint32_t>(body.size());
+        std::uint32_t crc = crc32(body.data(), body.size());
+
+        Journal &j = g_journal;
+        std::lock_guard<std::mutex> lock(j.mutex);
+        if (!j.open || j.failed)
+            return;
+        // the writer only sleeps with nothing pending; skip the wakeup otherwise
+        const bool wake = j.pending.empty() && !j.writing;
+        j.pending.append(reinterpret_cast<const char *>(&len), sizeof(len));
+        j.pending.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        j.pending.append(body);
+        j.appended += RECORD_HEADER + body.size();
+        if (wake)
+            j.wake.notify_one();
+    }
+
+    static bool apply_record(RecordType type, RecordReader &r)
+    {
+        switch (type)
+        {
+        case RecordType::Match:
+        {
+            Match m;
+            if (!decode_match(r, m))
+                return false;
+            restore_match(std::move(m));
+            return true;
+        }
+        case RecordType::Claim:
+        {
+            std::string id = r.string();
+            std::uint8_t team = r.integer<std::uint8_t>();
+            std::string token = r.string();
+            if (!r.ok || team > 1)
+                return false;
+            MatchHandle m = get_match(id);
+            if (m)
+                m->teamCaptainTokens[team] = std::move(token);
+            return true;
+        }
+        case RecordType::Action:
+        {
+            std::string id = r.string();
+            std::uint32_t stepIdx = r.integer<std::uint32_t>();
+            std::uint8_t team = r.integer<std::uint8_t>();
+            std::uint8_t action = r.integer<std::uint8_t>();
+            int value = r.integer<std::int32_t>();
+            if (!r.ok || action > static_cast<std::uint8_t>(ActionType::Side))
+                return false;
+            MatchHandle m = get_match(id);
+            // compaction may already have captured this step in a Match record
+            if (m && m->currentStepIndex == stepIdx &&
+                !apply_action(*m, team, static_cast<ActionType>(action), value))
+                std::cerr << "[Journal] Action on " << id << " step " << stepIdx << " no longer applies" << std::endl;
+            return true;
+        }
+        case RecordType::Expire:
+        {
+            std::string id = r.string();
+            if (!r.ok)
+                return false;
+            erase_match(id);
+            return true;
+        }
+        }
+        return false;
+    }
+
+    bool replay_journal(const std::string &dir, JournalReplayStats &stats, std::string &error)
+    {
+        stats = JournalReplayStats();
+        std::string data;
+
+        // the snapshot is the base; only segments it does not cover are replayed
+        std::uint64_t firstGeneration = 0;
+        struct stat st;
+        if (stat(snapshot_path(dir).c_str(), &st) == 0 &&
+            !load_snapshot(snapshot_path(dir), firstGeneration, stats.snapshotMatches, error))
+            return false;
+
+        for (std::uint64_t gen : list_segments(dir))
+        {
+            if (gen < firstGeneration)
+                continue;
+            std::string path = segment_path(dir, gen);
+            data.clear();
+            if (!read_file(path, data))
+            {
+                error = "cannot read " + path + ": " + std::strerror(errno);
+                return false;
+            }
+            ++stats.segments;
+
+            std::size_t off = 0;
+            while (off < data.size())
+            {
+                std::uint32_t len = 0;
+                std::uint32_t crc = 0;
+                if (data.size() - off < RECORD_HEADER)
+                    break;
+                std::memcpy(&len, data.data() + off, sizeof(len));
+                std::memcpy(&crc, data.data() + off + 4, sizeof(crc));
+                if (len == 0 || len > MAX_RECORD || data.size() - off - RECORD_HEADER < len)
+                    break;
+                const char *body = data.data() + off + RECORD_HEADER;
+                if (crc32(body, len) != crc)
+                    break;
+
+                RecordReader r(body + 1, len - 1);
+                if (!apply_record(static_cast<RecordType>(body[0]), r))
+                    std::cerr << "[Journal] Skipping malformed record in " << path << std::endl;
+                ++stats.records;
+                off += RECORD_HEADER + len;
+            }
+
+            if (off < data.size())
+            {
+                // a crash mid-write; everything before it is intact
+                ++stats.tornTails;
+                std::cerr << "[Journal] Ignoring " << (data.size() - off) << " trailing bytes in " << path << std::endl;
+            }
+        }
+
+        return true;
+    }
+
+    static int open_segment(const std::string &dir, std::uint64_t generation)
+    {
+        int fd = ::open(segment_path(dir, generation).c_str(),
+                        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd >= 0)
+            sync_dir(dir);
+        return fd;
+    }
+
+    bool open_journal(const std::string &dir, std::string &error)
+    {
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            error = "cannot create " + dir + ": " + std::strerror(errno);
+            return false;
+        }
+
+        JournalReplayStats stats;
+        if (!replay_journal(dir, stats, error))
+            return false;
+
+        std::vector<std::uint64_t> gens = list_segments(dir);
+        std::uint64_t existingBytes = 0;
+        for (std::uint64_t gen : gens)
+        {
+            struct stat st;
+            if (stat(segment_path(dir, gen).c_str(), &st) == 0)
+                existingBytes += static_cast<std::uint64_t>(st.st_size);
+        }
+
+        std::uint64_t generation = gens.empty() ? 1 : gens.back() + 1;
+        int fd = open_segment(dir, generation);
+        if (fd < 0)
+        {
+            error = "cannot open " + segment_path(dir, generation) + ": " + std::strerror(errno);
+            return false;
+        }
+
+        Journal &j = g_journal;
+        {
+            std::lock_guard<std::mutex> lock(j.mutex);
+            j.open = true;
+            j.stop = false;
+            j.dir = dir;
+            j.fd = fd;
+            j.generation = generation;
+            j.pending.clear();
+            j.failed = false;
+            j.appended = j.durable = 0;
+            j.segmentBytes = existingBytes;
+            j.liveBytes = 0;
+        }
+        j.writer = std::thread(writer_loop);
+
+        std::cout << "[Journal] Mapped " << stats.snapshotMatches << " snapshot matches, replayed "
+                  << stats.records << " records from " << stats.segments << " segments" << std::endl;
+        return true;
+    }
+
+    bool journal_sync()
+    {
+        Journal &j = g_journal;
+        std::unique_lock<std::mutex> lock(j.mutex);
+        const std::uint64_t target = j.appended;
+        j.drained.wait(lock, [&]()
+                       { return !j.open || j.failed || j.durable >= target; });
+        return !j.failed;
+    }
+
+    bool journal_available()
+    {
+        Journal &j = g_journal;
+        std::lock_guard<std::mutex> lock(j.mutex);
+        return !j.failed;
+    }
+
+    void close_journal()
+    {
+        std::lock_guard<std::mutex> compactLock(g_compactMutex);
+        Journal &j = g_journal;
+        {
+            std::lock_guard<std::mutex> lock(j.mutex);
+            if (!j.open)
+                return;
+            j.stop = true;
+            j.wake.notify_one();
+        }
+        j.writer.join();
+
+        std::lock_guard<std::mutex> lock(j.mutex);
+        j.open = false;
+        ::close(j.fd);
+        j.fd = -1;
+        j.drained.notify_all();
+    }
+
+    void journal_match(const Match &m)
+    {
+        std::string payload;
+        RecordWriter w(payload);
+        encode_match(w, m);
+        append(RecordType::Match, payload);
+    }
+
+    void journal_claim(const Match &m, int team)
+    {
+        std::string payload;
+        RecordWriter w(payload);
+        w.string(m.id);
+        w.integer(static_cast<std::uint8_t>(team));
+        w.string(m.teamCaptainTokens[team]);
+        append(RecordType::Claim, payload);
+    }
+
+    void journal_action(const Match &m, std::size_t stepIdx, int team, ActionType action, int value)
+    {
+        std::string payload;
+        RecordWriter w(payload);
+        w.string(m.id);
+        w.integer(static_cast<std::uint32_t>(stepIdx));
+        w.integer(static_cast<std::uint8_t>(team));
+        w.integer(static_cast<std::uint8_t>(action));
+        w.integer(static_cast<std::int32_t>(value));
+        append(RecordType::Action, payload);
+    }
+
+    void journal_expire(const std::string &matchId)
+    {
+        std::string payload;
+        RecordWriter w(payload);
+        w.string(matchId);
+        append(RecordType::Expire, payload);
+    }
+
+    // Seal the current segment and continue in the next; returns the new generation
+    static std::uint64_t rotate_segment()
+    {
+        Journal &j = g_journal;
+        std::unique_lock<std::mutex> lock(j.mutex);
+        j.drained.wait(lock, [&]()
+                       { return !j.writing; });
+
+        if (j.failed)
+            return j.generation;
+
+        // records appended before the switch belong to the old segment
+        const bool ok = write_all(j.fd, j.pending) && fdatasync(j.fd) == 0;
+        if (!ok)
+        {
+            perror("[Journal] write");
+            j.failed = true;
+            j.pending.clear();
+            j.drained.notify_all();
+            return j.generation;
+        }
+        j.durable += j.pending.size();
+        j.segmentBytes += j.pending.size();
+        j.pending.clear();
+
+        int fd = open_segment(j.dir, j.generation + 1);
+        if (fd < 0)
+        {
+            perror("[Journal] rotate");
+            return j.generation;
+        }
+        ::close(j.fd);
+        j.fd = fd;
+        j.generation += 1;
+        j.drained.notify_all();
+        return j.generation;
+    }
+
+    void compact_journal()
+    {
+        std::lock_guard<std::mutex> compactLock(g_compactMutex);
+        Journal &j = g_journal;
+        std::string dir;
+        {
+            std::lock_guard<std::mutex> lock(j.mutex);
+            if (!j.open || j.failed)
+                return;
+            dir = j.dir;
+        }
+
+        // everything before the new segment is covered by the snapshot; records
+        // racing with it land in the new segment and replay idempotently on top
+        auto start = std::chrono::steady_clock::now();
+        std::uint64_t generation = rotate_segment();
+        if (!journal_available())
+            return;
+        std::string error;
+        if (!write_snapshot(snapshot_path(dir), generation, error))
+        {
+            std::cerr << "[Journal] Snapshot failed, keeping segments: " << error << std::endl;
+            std::lock_guard<std::mutex> lock(j.mutex);
+            j.lastCompaction = std::chrono::steady_clock::now();
+            return;
+        }
+        sync_dir(dir);
+
+        std::uint64_t removed = 0;
+        for (std::uint64_t gen : list_segments(dir))
+        {
+            if (gen >= generation)
+                break;
+            std::string path = segment_path(dir, gen);
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0 && unlink(path.c_str()) == 0)
+                removed += static_cast<std::uint64_t>(st.st_size);
+        }
+        sync_dir(dir);
+
+        struct stat st;
+        std::uint64_t snapshotBytes = stat(snapshot_path(dir).c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+        {
+            std::lock_guard<std::mutex> lock(j.mutex);
+            j.liveBytes = snapshotBytes;
+            j.segmentBytes -= std::min(j.segmentBytes, removed);
+            j.lastCompaction = std::chrono::steady_clock::now();
+        }
+
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "[Journal] Snapshot of " << snapshotBytes << " bytes replaces segments before "
+                  << generation << " (" << ms << "ms)" << std::endl;
+    }
+
+    void maybe_compact_journal()
+    {
+        bool due;
+        {
+            Journal &j = g_journal;
+            std::lock_guard<std::mutex> lock(j.mutex);
+            const bool grown = j.segmentBytes > std::max(COMPACT_MIN_BYTES, 2 * j.liveBytes);
+            const bool stale = j.segmentBytes > 0 && std::chrono::steady_clock::now() - j.lastCompaction > SNAPSHOT_INTERVAL;
+            due = j.open && (grown || stale);
+        }
+        if (due)
+            compact_journal();
+    }
+}
@@ -0,0 +1,145 @@
+#include "../include/map_catalog.hpp"
+#include "../include/json_writer.hpp"
+#include "../include/veto_format.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace pb
+{
+    static std::atomic<std::uint64_t> g_nextGeneration{1};
+    static MapCatalogPtr g_catalog;
+
+    static MapCatalogPtr make_catalog(std::vector<Map> maps)
+    {
+        auto catalog = std::make_shared<MapCatalog>();
+        catalog->maps = std::move(maps);
+        catalog->generation = g_nextGeneration++;
+
+        JsonWriter w(catalog->mapsJson);
+        w.raw("\"availableMaps\":[");
+        for (std::size_t i = 0; i < catalog->maps.size(); ++i)
+        {
+            const Map &map = catalog->maps[i];
+            if (i)
+                w.raw(',');
+            w.raw("{\"id\":");
+            w.integer(map.id);
+            w.raw(",\"name\":");
+            w.string(map.name);
+            w.raw(",\"previewUrl\":");
+            w.string(map.previewUrl);
+            w.raw(",\"mapImgUrl\":");
+            w.string(map.mapImgUrl);
+            w.raw('}');
+        }
+        w.raw(']');
+        return catalog;
+    }
+
+    MapCatalogPtr default_map_catalog()
+    {
+        static const MapCatalogPtr catalog = make_catalog({
+            {1, "Abyss", "public/videos/abyss.mp4", "public/mapimgs/abyss.webp"},
+            {2, "Ascent", "public/videos/ascent.mp4", "public/mapimgs/ascent.webp"},
+            {3, "Bind", "public/videos/bind.mp4", "public/mapimgs/bind.webp"},
+            {4, "Haven", "public/videos/havenb.mp4", "public/mapimgs/haven.webp"},
+            {5, "Icebox", "public/videos/icebox.mp4", "public/mapimgs/icebox.webp"},
+            {6, "Lotus", "public/videos/lotus.mp4", "public/mapimgs/lotus.webp"},
+            {7, "Split", "public/videos/split.mp4", "public/mapimgs/split.webp"},
+        });
+        return catalog;
+    }
+
+    MapCatalogPtr current_map_catalog()
+    {
+        MapCatalogPtr catalog = std::atomic_load(&g_catalog);
+        return catalog ? catalog : default_map_catalog();
+    }
+
+    void set_map_catalog(MapCatalogPtr catalog)
+    {
+        std::atomic_store(&g_catalog, std::move(catalog));
+    }
+
+    MapCatalogPtr load_map_catalog(const std::string &path, std::string &error)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+
+        std::vector<Map> maps;
+        std::string line;
+        int lineNo = 0;
+        while (std::getline(in, line))
+        {
+            ++lineNo;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::istringstream fields(line);
+            std::string idStr;
+            Map map;
+            if (!std::getline(fields, idStr, ',') || !std::getline(fields, map.name, ',') ||
+                !std::getline(fields, map.previewUrl, ',') || !std::getline(fields, map.mapImgUrl))
+            {
+                error = path + ":" + std::to_string(lineNo) + ": expected id,name,previewUrl,mapImgUrl";
+                return nullptr;
+            }
+
+            map.id = std::atoi(idStr.c_str());
+            if (map.id <= 0)
+            {
+                error = path + ":" + std::to_string(lineNo) + ": map id must be a positive integer";
+                return nullptr;
+            }
+            for (const Map &other : maps)
+            {
+                if (other.id == map.id)
+                {
+                    error = path + ":" + std::to_string(lineNo) + ": duplicate map id";
+                    return nullptr;
+                }
+            }
+            maps.push_back(std::move(map));
+        }
+
+        if (maps.empty())
+        {
+            error = path + ": no maps defined";
+            return nullptr;
+        }
+        return make_catalog(std::move(maps));
+    }
+
+    bool reload_map_catalog(const std::string &path)
+    {
+        std::string error;
+        MapCatalogPtr catalog = load_map_catalog(path, error);
+        if (!catalog)
+        {
+            std::cerr << "[Maps] Keeping current map pool: " << error << std::endl;
+            return false;
+        }
+        // every registered format must still be able to finish on the new pool
+        std::size_t needed = max_maps_needed();
+        if (catalog->maps.size() < needed)
+        {
+            std::cerr << "[Maps] Keeping current map pool: " << path << " has " << catalog->maps.size()
+                      << " maps but the registered formats need " << needed << std::endl;
+            return false;
+        }
+
+        set_map_catalog(catalog);
+        std::cout << "[Maps] Loaded " << catalog->maps.size() << " maps from " << path
+                  << " (generation " << catalog->generation << ")" << std::endl;
+        return true;
+    }
+}
@@ -1,6 +1,10 @@
 #include "../include/match.hpp"
 #include "../include/state.hpp"
 #include "../include/websockets.hpp"
+#include "../include/journal.hpp"
+#include "../include/json_writer.hpp"
+#include "../include/metrics.hpp"
+#include "../include/event_loop.hpp"
 
 using namespace pb;
 
@@ -9,61 +13,333 @@ MatchContext& get_match_context() {
     return ctx;
 }
 
-void broadcast_match_update(const pb::Match& m) {
-    std::string payload = pb::match_to_json(m);
+static SubscriberShard& subscriber_shard(const std::string& matchId) {
+    return get_match_context().subscribers[pb::match_shard_index(matchId)];
+}
+
+// Per-match share of the egress counters; the caller holds the match lock
+static void send_match_text(const ConnectionPtr& conn, pb::Match& m, std::string msg) {
+    m.wsUncompressedBytes += msg.size();
+    m.wsSentBytes += send_ws_text(*conn, std::move(msg));
+}
 
-    auto& ctx = get_match_context();
-    std::lock_guard<std::mutex> lock(ctx.wsClientsMutex);
-    for (auto it = ctx.wsClients.begin(); it != ctx.wsClients.end(); ++it) {
-        if (it->matchId == m.id) {
-            send_ws_text(it->fd, payload);
+void broadcast_match_update(pb::Match& m, std::size_t stepIdx) {
+    const std::uint64_t start = metrics::now_ns();
+    // serialized, framed and (at most once) compressed, then shared by every subscriber's queue
+    WsBroadcastFrame frame(pb::match_to_patch_json(m, stepIdx));
+
+    std::size_t fanout = 0;
+    {
+        SubscriberShard& shard = subscriber_shard(m.id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.byMatch.find(m.id);
+        if (it != shard.byMatch.end()) {
+            for (const ConnectionPtr& conn : it->second) {
+                frame.send(*conn);
+            }
+            fanout = it->second.size();
         }
     }
+    m.wsUncompressedBytes += frame.uncompressed_bytes();
+    m.wsSentBytes += frame.sent_bytes();
+    metrics::broadcastFanout.observe(fanout);
+    metrics::broadcastDuration.observe(metrics::now_ns() - start);
+}
+
+bool perform_action(pb::Match& m, int team, pb::ActionType action, int value) {
+    const std::size_t stepIdx = m.currentStepIndex;
+    if (!pb::apply_action(m, team, action, value)) {
+        return false;
+    }
+    pb::journal_action(m, stepIdx, team, action, value);
+    broadcast_match_update(m, stepIdx);
+    return true;
+}
+
+bool parse_action_type(std::string_view name, pb::ActionType& out) {
+    if (name == "ban") {
+        out = ActionType::Ban;
+    }
+    else if (name == "pick") {
+        out = ActionType::Pick;
+    }
+    else if (name == "side") {
+        out = ActionType::Side;
+    }
+    else {
+        return false;
+    }
+    return true;
 }
 
-void handle_websocket_client(int client_fd) {
-    std::string msg;
-    if (!recv_ws_frame(client_fd, msg)) {
-        close(client_fd);
+CaptainActionResult perform_captain_action(pb::Match& m, int team, const std::string& token,
+                                           pb::ActionType action, int value) {
+    if (team < 0 || team > 1) {
+        return CaptainActionResult::InvalidTeam;
+    }
+    if (m.teamCaptainTokens[team].empty() || token.empty() || token != m.teamCaptainTokens[team]) {
+        return CaptainActionResult::Forbidden;
+    }
+    if (!pb::journal_available()) {
+        return CaptainActionResult::Unavailable;
+    }
+    if (!perform_action(m, team, action, value)) {
+        return CaptainActionResult::Rejected;
+    }
+    return CaptainActionResult::Applied;
+}
+
+static void send_command_error(const ConnectionPtr& conn, std::string_view rid, int status, std::string_view error) {
+    std::string out;
+    JsonWriter w(out);
+    w.raw("{\"type\":\"error\",\"rid\":");
+    w.string(rid);
+    w.raw(",\"status\":");
+    w.integer(status);
+    w.raw(",\"error\":");
+    w.string(error);
+    w.raw('}');
+    send_ws_text(*conn, std::move(out));
+}
+
+// An action sent over the socket instead of GET /match/action; answered with an ack or error
+static void handle_websocket_command(const ConnectionPtr& conn, std::string_view message) {
+    QueryParams params(message);
+    std::string rid = params.get("rid");
+    if (conn->matchId.empty()) {
+        send_command_error(conn, rid, 400, "Not subscribed to a match");
         return;
     }
 
-    std::string matchId = msg;
-    if (matchId.empty()) {
-        close(client_fd);
+    std::string_view actStr;
+    int team = -1;
+    int value = 0;
+    pb::ActionType action;
+    if (!params.find("action", actStr) || !params.get_int("team", team) || !params.get_int("map", value)) {
+        send_command_error(conn, rid, 400, "Missing parameters");
+        return;
+    }
+    if (!parse_action_type(actStr, action)) {
+        send_command_error(conn, rid, 400, "Unknown action");
         return;
     }
 
-    auto& ctx = get_match_context();
+    std::string ack;
+    CaptainActionResult result;
     {
-        std::lock_guard<std::mutex> lock(ctx.wsClientsMutex);
-        ctx.wsClients.push_back(WsClient{client_fd, matchId});
+        pb::MatchHandle m = pb::get_match(conn->matchId);
+        if (!m) {
+            send_command_error(conn, rid, 404, "Match not found");
+            return;
+        }
+        result = perform_captain_action(*m, team, params.get("token"), action, value);
+        if (result == CaptainActionResult::Applied) {
+            JsonWriter w(ack);
+            w.raw("{\"type\":\"ack\",\"rid\":");
+            w.string(rid);
+            w.raw(",\"version\":");
+            w.integer(m->version);
+            w.raw('}');
+        }
     }
 
+    switch (result) {
+    case CaptainActionResult::Applied:
+        send_ws_text(*conn, std::move(ack));
+        break;
+    case CaptainActionResult::InvalidTeam:
+        send_command_error(conn, rid, 400, "Invalid team index");
+        break;
+    case CaptainActionResult::Forbidden:
+        send_command_error(conn, rid, 403, "Not authorized for this team");
+        break;
+    case CaptainActionResult::Rejected:
+        send_command_error(conn, rid, 400, "Invalid action");
+        break;
+    case CaptainActionResult::Unavailable:
+        send_command_error(conn, rid, 503, "Journal unavailable");
+        break;
+    }
+}
+
+static void send_snapshot(const ConnectionPtr& conn) {
+    pb::MatchHandle m = pb::get_match(conn->matchId);
+    if (m) {
+        send_match_text(conn, *m, pb::match_to_json(*m));
+    }
+}
+
+// Returns false if there is no such match; the client gets an error and a close frame
+static bool subscribe_websocket_client(const ConnectionPtr& conn, const std::string& matchId) {
+    // Register and snapshot under the match lock that broadcasts also hold,
+    // so the first patch a client sees always follows its snapshot
+    pb::MatchHandle m = pb::get_match(matchId);
+    if (!m) {
+        send_ws_text(*conn, "{\"type\":\"error\",\"status\":404,\"error\":\"Match not found\"}");
+        // 1008: policy violation
+        send_ws_frame(*conn, make_ws_frame(WS_OPCODE_CLOSE, std::string("\x03\xf0", 2)));
+        conn->close_after_flush();
+        return false;
+    }
+
+    conn->matchId = matchId;
     {
-        std::lock_guard<std::mutex> lock(ctx.matchMutex);
-        pb::Match* m = pb::get_match(matchId);
-        if (m) {
-            send_ws_text(client_fd, pb::match_to_json(*m));
+        SubscriberShard& shard = subscriber_shard(matchId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.byMatch[matchId].insert(conn);
+    }
+    send_match_text(conn, *m, pb::match_to_json(*m));
+    return true;
+}
+
+// Returns false if the client broke the protocol or named an unknown match and is being disconnected
+static bool handle_websocket_message(const ConnectionPtr& conn, uint8_t opcode, std::string_view message) {
+    // match ids never contain '=', so a query string is always a command
+    if (opcode == WS_OPCODE_TEXT && message.find('=') != std::string_view::npos) {
+        handle_websocket_command(conn, message);
+    }
+    else if (conn->matchId.empty()) {
+        // the first message must name the match to follow
+        if (opcode != WS_OPCODE_TEXT || message.empty()) {
+            conn->shutdown();
+            return false;
         }
+        std::string matchId(message);
+        EventLoop* owner = EventLoop::owner_of(matchId);
+        if (owner && owner != conn->loop) {
+            // subscribed once the owning loop has the socket
+            conn->pendingSubscription = std::move(matchId);
+            return true;
+        }
+        return subscribe_websocket_client(conn, matchId);
+    }
+    else if (opcode == WS_OPCODE_TEXT && message == "resync") {
+        send_snapshot(conn);
     }
+    // other messages are ignored
+    return true;
+}
+
+void handle_websocket_client(const ConnectionPtr& conn) {
+    std::string& buf = conn->inbuf;
+    std::size_t offset = 0;
 
-    while (true) {
-        std::string payload;
-        if (!recv_ws_frame(client_fd, payload)) {
+    if (!conn->pendingSubscription.empty()) {
+        // just handed over by another loop, which left the rest of the stream in buf
+        std::string matchId;
+        matchId.swap(conn->pendingSubscription);
+        if (!subscribe_websocket_client(conn, matchId)) {
+            buf.clear();
+            return;
+        }
+    }
+
+    // every complete frame already received is handled in this one pass
+    while (offset < buf.size()) {
+        std::size_t consumed = 0;
+        WsFrame frame;
+        WsFrameStatus st = parse_ws_frame(&buf[offset], buf.size() - offset, consumed, frame);
+        if (st == WsFrameStatus::Incomplete) {
             break;
         }
+        if (st == WsFrameStatus::Error) {
+            buf.clear();
+            conn->shutdown();
+            return;
+        }
+        offset += consumed;
+
+        uint8_t opcode = 0;
+        std::string_view message;
+        WsMessageAssembler::Result r = conn->wsMessages.feed(frame, opcode, message);
+        if (r == WsMessageAssembler::Result::Pending) {
+            continue;
+        }
+        if (r == WsMessageAssembler::Result::Error) {
+            buf.clear();
+            conn->shutdown();
+            return;
+        }
+
+        if (r == WsMessageAssembler::Result::Control) {
+            if (opcode == WS_OPCODE_PING) {
+                send_ws_frame(*conn, make_ws_frame(WS_OPCODE_PONG, std::string(message)));
+            }
+            else if (opcode == WS_OPCODE_CLOSE) {
+                // echo the status code, then finish the closing handshake
+                send_ws_frame(*conn, make_ws_frame(WS_OPCODE_CLOSE, std::string(message.substr(0, 2))));
+                conn->close_after_flush();
+                buf.clear();
+                return;
+            }
+            continue;
+        }
+
+        std::string inflated;
+        if (conn->wsMessages.compressed()) {
+            if (!conn->wsDeflate) {
+                buf.clear();
+                conn->shutdown();
+                return;
+            }
+            if (!conn->wsInflater) {
+                conn->wsInflater.reset(new WsInflater(conn->wsDeflateParams.clientNoContextTakeover));
+            }
+            if (!conn->wsInflater->inflate_message(message, inflated)) {
+                buf.clear();
+                conn->shutdown();
+                return;
+            }
+            message = inflated;
+        }
+
+        if (!handle_websocket_message(conn, opcode, message)) {
+            buf.clear();
+            return;
+        }
+        if (!conn->pendingSubscription.empty()) {
+            // the owner takes it from here; nothing may touch conn after hand_off
+            buf.erase(0, offset);
+            EventLoop* owner = EventLoop::owner_of(conn->pendingSubscription);
+            conn->loop->hand_off(conn, *owner);
+            return;
+        }
+    }
+
+    buf.erase(0, offset);
+}
+
+void remove_websocket_client(const ConnectionPtr& conn) {
+    if (conn->matchId.empty()) {
+        return;
     }
 
+    SubscriberShard& shard = subscriber_shard(conn->matchId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.byMatch.find(conn->matchId);
+    if (it == shard.byMatch.end()) {
+        return;
+    }
+    it->second.erase(conn);
+    if (it->second.empty()) {
+        shard.byMatch.erase(it);
+    }
+}
+
+void drop_match_subscribers(const std::string& matchId) {
+    std::unordered_set<ConnectionPtr> dropped;
     {
-        std::lock_guard<std::mutex> lock(ctx.wsClientsMutex);
-        auto& v = ctx.wsClients;
-        v.erase(std::remove_if(v.begin(), v.end(),
-                               [client_fd](const WsClient& c) {
-                                   return c.fd == client_fd;
-                               }),
-                v.end());
+        SubscriberShard& shard = subscriber_shard(matchId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.byMatch.find(matchId);
+        if (it == shard.byMatch.end()) {
+            return;
+        }
+        dropped.swap(it->second);
+        shard.byMatch.erase(it);
     }
 
-    close(client_fd);
-}
\ No newline at end of file
+    for (const ConnectionPtr& conn : dropped) {
+        conn->shutdown();
+    }
+}
@@ -3,6 +3,10 @@
 #include "../include/match.hpp"
 #include "../include/state.hpp"
 #include "../include/http.hpp"
+#include "../include/journal.hpp"
+#include "../include/metrics.hpp"
+#include "../include/veto_format.hpp"
+#include "../include/json_writer.hpp"
 
 using namespace pb;
 
@@ -22,107 +26,141 @@ std::string generate_captain_id()
     return s;
 }
 
-std::string handle_match_http(const HttpRequest &req)
+// Changes are refused once the journal cannot make them durable
+static std::string journal_unavailable(const HttpRequest &req)
 {
-    auto &ctx = get_match_context();
+    return make_http_response("Journal unavailable\n", "text/plain", 503, "Service Unavailable", req.keepAlive);
+}
 
+std::string handle_match_http(const HttpRequest &req)
+{
     if (req.method == "OPTIONS")
     {
         // return empty 204 with CORS headers
-        return make_http_response("", "text/plain", 204, "No Content");
+        return make_http_response("", "text/plain", 204, "No Content", req.keepAlive);
     }
 
     if (req.method == "GET" && req.path == "/match/create")
     {
-        std::string teamA = get_query_param(req.query, "teamA");
-        std::string teamB = get_query_param(req.query, "teamB");
-        std::string series = get_query_param(req.query, "series");
-
-        std::lock_guard<std::mutex> lock(ctx.matchMutex);
-        Match &m = create_match(teamA, teamB, series);
-        std::string body = "{\"matchId\":\"" + m.id + "\"}";
-        return make_http_response(body, "application/json");
+        QueryParams params(req.query);
+        std::string teamA = params.get("teamA");
+        std::string teamB = params.get("teamB");
+        std::string series = params.get("series");
+        // no series means bo1; a name we do not know is an error rather than a silent bo1
+        if (series.empty())
+            series = "bo1";
+        else if (!find_veto_format(series))
+            return make_http_response("Unknown series\n", "text/plain", 400, "Bad Request", req.keepAlive);
+
+        if (!journal_available())
+            return journal_unavailable(req);
+        MatchHandle m = create_match(teamA, teamB, series);
+        if (!m)
+            return make_http_response("Server busy\n", "text/plain", 503, "Service Unavailable", req.keepAlive,
+                                      "Retry-After: 1\r\n");
+        std::string body = "{\"matchId\":\"" + m->id + "\"}";
+        return make_http_response(body, "application/json", 200, "OK", req.keepAlive);
+    }
+    else if (req.method == "GET" && req.path == "/metrics")
+    {
+        return make_http_response(metrics::render_metrics(), "text/plain; version=0.0.4", 200, "OK", req.keepAlive);
     }
     else if (req.method == "GET" && req.path == "/match/state")
     {
-        std::string id = get_query_param(req.query, "id");
-        std::lock_guard<std::mutex> lock(ctx.matchMutex);
-        Match *m = get_match(id);
+        std::string id = QueryParams(req.query).get("id");
+        MatchHandle m = get_match(id);
         if (!m)
         {
-            return make_http_response("Match not found\n", "text/plain", 404, "Not Found");
+            return make_http_response("Match not found\n", "text/plain", 404, "Not Found", req.keepAlive);
         }
         else
         {
             std::string body = match_to_json(*m);
-            return make_http_response(body, "application/json");
+            return make_http_response(body, "application/json", 200, "OK", req.keepAlive);
+        }
+    }
+    else if (req.method == "GET" && req.path == "/match/egress")
+    {
+        // WebSocket bytes pushed to this match's subscribers, before and after permessage-deflate
+        std::string id = QueryParams(req.query).get("id");
+        MatchHandle m = get_match(id);
+        if (!m)
+        {
+            return make_http_response("Match not found\n", "text/plain", 404, "Not Found", req.keepAlive);
         }
+        std::string body;
+        JsonWriter w(body);
+        w.raw("{\"matchId\":");
+        w.string(m->id);
+        w.raw(",\"uncompressedBytes\":");
+        w.integer(m->wsUncompressedBytes);
+        w.raw(",\"sentBytes\":");
+        w.integer(m->wsSentBytes);
+        w.raw(",\"savedBytes\":");
+        w.integer(m->wsUncompressedBytes - m->wsSentBytes);
+        w.raw('}');
+        return make_http_response(body, "application/json", 200, "OK", req.keepAlive);
     }
     else if (req.method == "GET" && req.path == "/match/action")
     {
-        std::string id = get_query_param(req.query, "id");
-        std::string teamStr = get_query_param(req.query, "team");
-        std::string actStr = get_query_param(req.query, "action");
-        std::string mapStr = get_query_param(req.query, "map");
-        std::string token = get_query_param(req.query, "token");
-
-        if (id.empty() || teamStr.empty() || actStr.empty() || mapStr.empty())
+        QueryParams params(req.query);
+        std::string_view idRaw, teamRaw, actStr, mapRaw;
+        if (!params.find("id", idRaw) || !params.find("team", teamRaw) ||
+            !params.find("action", actStr) || !params.find("map", mapRaw) ||
+            idRaw.empty() || teamRaw.empty() || actStr.empty() || mapRaw.empty())
         {
-            return make_http_response("Missing parameters\n", "text/plain", 400, "Bad Request");
+            return make_http_response("Missing parameters\n", "text/plain", 400, "Bad Request", req.keepAlive);
         }
 
-        int team = std::stoi(teamStr);
-        int mapId = std::stoi(mapStr);
+        // validated before any lookup or locking, so malformed spam is cheap to reject
+        int team = -1;
+        int mapId = 0;
+        if (!params.get_int("team", team) || !params.get_int("map", mapId))
+        {
+            return make_http_response("Invalid parameters\n", "text/plain", 400, "Bad Request", req.keepAlive);
+        }
 
         ActionType at;
-        if (actStr == "ban")
-            at = ActionType::Ban;
-        else if (actStr == "pick")
-            at = ActionType::Pick;
-        else if (actStr == "side")
-            at = ActionType::Side;
-        else
-            return make_http_response("Unknown action in determining action type\n", "text/plain", 400, "Bad Request");
+        if (!parse_action_type(actStr, at))
+            return make_http_response("Unknown action in determining action type\n", "text/plain", 400, "Bad Request", req.keepAlive);
 
-        auto &ctx = get_match_context();
-        std::lock_guard<std::mutex> lock(ctx.matchMutex);
-        Match *m = get_match(id);
+        std::string id = params.get("id");
+        std::string token = params.get("token");
+        MatchHandle m = get_match(id);
         if (!m)
         {
-            return make_http_response("Match not found\n", "text/plain", 404, "Not Found");
+            return make_http_response("Match not found\n", "text/plain", 404, "Not Found", req.keepAlive);
         }
 
-        if (team < 0 || team > 1)
-        {
-            return make_http_response("Invalid team index\n", "text/plain", 400, "Bad Request");
-        }
-        else if (m->teamCaptainTokens[team].empty() || token.empty() || token != m->teamCaptainTokens[team])
+        switch (perform_captain_action(*m, team, token, at, mapId))
         {
-            return make_http_response("Not authorized to be join this team.\n", "text/plain", 403, "Forbidden");
+        case CaptainActionResult::InvalidTeam:
+            return make_http_response("Invalid team index\n", "text/plain", 400, "Bad Request", req.keepAlive);
+        case CaptainActionResult::Forbidden:
+            return make_http_response("Not authorized to be join this team.\n", "text/plain", 403, "Forbidden", req.keepAlive);
+        case CaptainActionResult::Rejected:
+            return make_http_response("Invalid action\n", "text/plain", 400, "Bad Request", req.keepAlive);
+        case CaptainActionResult::Unavailable:
+            return journal_unavailable(req);
+        case CaptainActionResult::Applied:
+            break;
         }
 
-        bool ok = apply_action(*m, team, at, mapId);
-        if (!ok)
-        {
-            return make_http_response("Invalid action\n", "text/plain", 400, "Bad Request");
-        }
-
-        broadcast_match_update(*m);
         std::string body = match_to_json(*m);
-        return make_http_response(body, "application/json");
+        return make_http_response(body, "application/json", 200, "OK", req.keepAlive);
     }
 
     else if (req.method == "GET" && req.path == "/match/join")
     {
-        std::string id = get_query_param(req.query, "id");
-        std::string teamStr = get_query_param(req.query, "team");
-        std::string token = get_query_param(req.query, "token");
+        QueryParams params(req.query);
+        std::string id = params.get("id");
+        std::string teamStr = params.get("team");
+        std::string token = params.get("token");
 
-        std::lock_guard<std::mutex> lock(ctx.matchMutex);
-        Match *m = get_match(id);
+        MatchHandle m = get_match(id);
         if (!m)
         {
-            return make_http_response("Match not found\n", "text/plain", 404, "Not Found");
+            return make_http_response("Match not found\n", "text/plain", 404, "Not Found", req.keepAlive);
         }
         else
         {
@@ -138,25 +176,24 @@ std::string handle_match_http(const HttpRequest &req)
             else
             {
                 // try to parse team index 0 or 1
-                try
-                {
-                    teamIndex = std::stoi(teamStr);
-                }
-                catch (...)
+                if (!params.get_int("team", teamIndex))
                 {
                     teamIndex = -1;
                 }
 
                 if (teamIndex < 0 || teamIndex > 1)
                 {
-                    return make_http_response("Invalid team index\n", "text/plain", 400, "Bad Request");
+                    return make_http_response("Invalid team index\n", "text/plain", 400, "Bad Request", req.keepAlive);
                 }
 
                 std::string &currentToken = m->teamCaptainTokens[teamIndex];
                 if (currentToken.empty())
                 {
+                    if (!journal_available())
+                        return journal_unavailable(req);
                     // claim captain for team if no captain was claimed yet
                     currentToken = generate_captain_id();
+                    journal_claim(*m, teamIndex);
                     outToken = currentToken;
                     role = "captain";
                 }
@@ -191,12 +228,12 @@ std::string handle_match_http(const HttpRequest &req)
             }
             body << "}";
 
-            return make_http_response(body.str(), "application/json");
+            return make_http_response(body.str(), "application/json", 200, "OK", req.keepAlive);
         }
     }
 
     else
     {
-        return make_http_response("Valorant BO3 map veto server\n", "text/plain");
+        return make_http_response("Valorant BO3 map veto server\n", "text/plain", 200, "OK", req.keepAlive);
     }
 }
\ No newline at end of file
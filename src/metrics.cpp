@@ -0,0 +1,208 @@
+#include "../include/metrics.hpp"
+#include "../include/state.hpp"
+#include "../include/websockets.hpp"
+
+#include <cstdio>
+
+namespace metrics
+{
+    // Latency buckets in ns: 10us .. 1s
+    static const std::initializer_list<std::uint64_t> LATENCY_BOUNDS_NS = {
+        10000, 25000, 50000, 100000, 250000, 500000,
+        1000000, 2500000, 5000000, 10000000, 50000000, 250000000, 1000000000};
+
+    Gauge websocketClients;
+    Counter websocketHeartbeatTimeouts;
+    Counter bytesSent;
+    Histogram broadcastFanout({0, 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 5000});
+    Histogram broadcastDuration(LATENCY_BOUNDS_NS, 1e-9);
+    Counter matchLockContended;
+    Histogram matchLockWait({1000, 5000, 10000, 50000, 100000, 500000, 1000000, 10000000}, 1e-9);
+
+    // Status codes tracked per route; anything else is counted as "other"
+    static const int STATUS_CODES[] = {101, 200, 204, 400, 403, 404, 413, 503};
+    static const std::size_t STATUS_COUNT = sizeof(STATUS_CODES) / sizeof(STATUS_CODES[0]);
+    static const std::size_t ROUTE_COUNT = static_cast<std::size_t>(HttpRoute::Count);
+    static const char *const ROUTE_NAMES[ROUTE_COUNT] = {
+        "create", "state", "action", "join", "egress", "ws", "metrics", "other"};
+
+    static Counter g_requests[ROUTE_COUNT][STATUS_COUNT + 1];
+    static Histogram g_actionLatency(LATENCY_BOUNDS_NS, 1e-9);
+    static Histogram g_stateLatency(LATENCY_BOUNDS_NS, 1e-9);
+
+    Histogram::Histogram(std::initializer_list<std::uint64_t> bounds, double scale)
+        : bounds(bounds), counts(new Bucket[bounds.size() + 1]), scale(scale)
+    {
+    }
+
+    void Histogram::observe(std::uint64_t value)
+    {
+        std::size_t i = 0;
+        while (i < bounds.size() && value > bounds[i])
+            ++i;
+        counts[i].count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static void append_number(std::string &out, double v)
+    {
+        char buf[32];
+        int n = std::snprintf(buf, sizeof(buf), "%.9g", v);
+        out.append(buf, static_cast<std::size_t>(n));
+    }
+
+    static void append_number(std::string &out, std::int64_t v)
+    {
+        out.append(std::to_string(v));
+    }
+
+    static void append_number(std::string &out, std::uint64_t v)
+    {
+        out.append(std::to_string(v));
+    }
+
+    // One "name{labels} value" line; counts are written as exact integers
+    template <class T>
+    static void append_sample(std::string &out, std::string_view name, std::string_view labels, T value)
+    {
+        out.append(name);
+        if (!labels.empty())
+        {
+            out.push_back('{');
+            out.append(labels);
+            out.push_back('}');
+        }
+        out.push_back(' ');
+        append_number(out, value);
+        out.push_back('\n');
+    }
+
+    void Histogram::render(std::string &out, std::string_view name, std::string_view labels) const
+    {
+        const std::string bucket = std::string(name) + "_bucket";
+        const std::string sep = labels.empty() ? "" : ",";
+        std::uint64_t cumulative = 0;
+        for (std::size_t i = 0; i <= bounds.size(); ++i)
+        {
+            cumulative += counts[i].count.load(std::memory_order_relaxed);
+            std::string le = std::string(labels) + sep + "le=\"";
+            if (i < bounds.size())
+            {
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "%.9g", static_cast<double>(bounds[i]) * scale);
+                le += buf;
+            }
+            else
+            {
+                le += "+Inf";
+            }
+            le += '"';
+            append_sample(out, bucket, le, cumulative);
+        }
+        append_sample(out, std::string(name) + "_sum", labels,
+                      static_cast<double>(sum.load(std::memory_order_relaxed)) * scale);
+        append_sample(out, std::string(name) + "_count", labels, cumulative);
+    }
+
+    HttpRoute http_route(std::string_view path)
+    {
+        if (path == "/match/action")
+            return HttpRoute::Action;
+        if (path == "/match/state")
+            return HttpRoute::State;
+        if (path == "/match/join")
+            return HttpRoute::Join;
+        if (path == "/match/egress")
+            return HttpRoute::Egress;
+        if (path == "/match/create")
+            return HttpRoute::Create;
+        if (path == "/ws")
+            return HttpRoute::WebSocket;
+        if (path == "/metrics")
+            return HttpRoute::Metrics;
+        return HttpRoute::Other;
+    }
+
+    void record_http_request(HttpRoute route, int statusCode, std::uint64_t durationNs)
+    {
+        std::size_t code = 0;
+        while (code < STATUS_COUNT && STATUS_CODES[code] != statusCode)
+            ++code;
+        g_requests[static_cast<std::size_t>(route)][code].add();
+
+        if (durationNs == 0)
+            return;
+        if (route == HttpRoute::Action)
+            g_actionLatency.observe(durationNs);
+        else if (route == HttpRoute::State)
+            g_stateLatency.observe(durationNs);
+    }
+
+    static void append_header(std::string &out, std::string_view name, std::string_view type, std::string_view help)
+    {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    std::string render_metrics()
+    {
+        std::string out;
+        out.reserve(16384);
+
+        append_header(out, "map_veto_http_requests_total", "counter", "HTTP requests answered, by route and status code.");
+        for (std::size_t r = 0; r < ROUTE_COUNT; ++r)
+        {
+            for (std::size_t c = 0; c <= STATUS_COUNT; ++c)
+            {
+                std::uint64_t n = g_requests[r][c].value();
+                if (n == 0)
+                    continue;
+                std::string labels = std::string("route=\"") + ROUTE_NAMES[r] + "\",code=\"" +
+                                     (c < STATUS_COUNT ? std::to_string(STATUS_CODES[c]) : "other") + "\"";
+                append_sample(out, "map_veto_http_requests_total", labels, n);
+            }
+        }
+
+        append_header(out, "map_veto_http_request_duration_seconds", "histogram", "Time to handle /match/action and /match/state.");
+        g_actionLatency.render(out, "map_veto_http_request_duration_seconds", "route=\"action\"");
+        g_stateLatency.render(out, "map_veto_http_request_duration_seconds", "route=\"state\"");
+
+        std::size_t phases[pb::PHASE_COUNT] = {};
+        pb::count_matches_by_phase(phases);
+        static const char *const PHASE_NAMES[pb::PHASE_COUNT] = {"ban", "pick", "side", "completed"};
+        append_header(out, "map_veto_matches", "gauge", "Live matches in memory, by phase.");
+        for (std::size_t p = 0; p < pb::PHASE_COUNT; ++p)
+            append_sample(out, "map_veto_matches", std::string("phase=\"") + PHASE_NAMES[p] + "\"",
+                          static_cast<std::uint64_t>(phases[p]));
+
+        append_header(out, "map_veto_websocket_clients", "gauge", "Open WebSocket connections.");
+        append_sample(out, "map_veto_websocket_clients", "", websocketClients.value());
+        append_header(out, "map_veto_websocket_heartbeat_timeouts_total", "counter", "WebSocket clients closed for not answering a ping.");
+        append_sample(out, "map_veto_websocket_heartbeat_timeouts_total", "",
+                      websocketHeartbeatTimeouts.value());
+
+        append_header(out, "map_veto_broadcast_fanout", "histogram", "Subscribers each match update was queued for.");
+        broadcastFanout.render(out, "map_veto_broadcast_fanout", "");
+        append_header(out, "map_veto_broadcast_duration_seconds", "histogram", "Time to serialize and queue one match update.");
+        broadcastDuration.render(out, "map_veto_broadcast_duration_seconds", "");
+
+        append_header(out, "map_veto_sent_bytes_total", "counter", "Bytes written to client sockets.");
+        append_sample(out, "map_veto_sent_bytes_total", "", bytesSent.value());
+
+        WsEgressStats egress = ws_egress_stats();
+        append_header(out, "map_veto_ws_messages_total", "counter", "WebSocket text messages queued, by encoding.");
+        append_sample(out, "map_veto_ws_messages_total", "encoding=\"deflate\"", egress.deflatedMessages);
+        append_sample(out, "map_veto_ws_messages_total", "encoding=\"plain\"",
+                      egress.messages - egress.deflatedMessages);
+        append_header(out, "map_veto_ws_payload_bytes_total", "counter", "WebSocket text payload bytes before and after permessage-deflate.");
+        append_sample(out, "map_veto_ws_payload_bytes_total", "stage=\"uncompressed\"", egress.uncompressedBytes);
+        append_sample(out, "map_veto_ws_payload_bytes_total", "stage=\"sent\"", egress.sentBytes);
+
+        append_header(out, "map_veto_match_lock_contended_total", "counter", "Match shard lock acquisitions that had to wait.");
+        append_sample(out, "map_veto_match_lock_contended_total", "", matchLockContended.value());
+        append_header(out, "map_veto_match_lock_wait_seconds", "histogram", "Time spent waiting for a contended match shard lock.");
+        matchLockWait.render(out, "map_veto_match_lock_wait_seconds", "");
+
+        return out;
+    }
+}
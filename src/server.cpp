@@ -3,7 +3,10 @@
 #include "../include/match.hpp"
 #include "../include/http_router.hpp"
 #include "../include/websockets.hpp"
-#include "../include/match.hpp"
+#include "../include/event_loop.hpp"
+#include "../include/veto_format.hpp"
+#include "../include/journal.hpp"
+#include "../include/snapshot.hpp"
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 #include <openssl/bio.h>
@@ -15,79 +18,108 @@
 #include <thread>
 #include <mutex>
 #include <chrono> 
+#include <memory>
+#include <vector>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <random>
 #include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
 using namespace pb;
 
 int main()
 {
     init_state();
 
-    // cleanup thread
+    // SIGHUP reloads the map pool; block it everywhere and handle it on one thread
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, nullptr);
+
+    const char *catalogEnv = std::getenv("MAP_CATALOG");
+    std::string catalogPath = catalogEnv ? catalogEnv : "config/maps.conf";
+    if (!reload_map_catalog(catalogPath))
+        std::cerr << "[Maps] Using built-in map pool" << std::endl;
+
+    const char *formatsEnv = std::getenv("VETO_FORMATS");
+    std::string formatsError;
+    if (!load_veto_formats(formatsEnv ? formatsEnv : "config/formats.conf", formatsError))
+        std::cerr << "[Formats] Custom formats not loaded: " << formatsError << std::endl;
+
+    // after the formats, which replayed matches refer to by name
+    const char *journalEnv = std::getenv("JOURNAL_DIR");
+    std::string journalError;
+    if (!open_journal(journalEnv ? journalEnv : "data", journalError))
+        std::cerr << "[Journal] Running without a journal: " << journalError << std::endl;
+    // snapshot matches load on first use; pull in the rest without delaying startup
+    std::thread(warm_snapshot).detach();
+
+    std::thread([hup, catalogPath]()
+                {
+        while (true) {
+            int sig = 0;
+            if (sigwait(&hup, &sig) == 0)
+                reload_map_catalog(catalogPath);
+        } })
+        .detach();
+
+    // cleanup thread: expire due matches in small batches every second
     std::thread([]()
                 {
         using namespace std::chrono_literals;
+        const std::size_t batch = 256;
         while (true) {
-            std::this_thread::sleep_for(10min);
-            auto& ctx = get_match_context();
-            std::lock_guard<std::mutex> lock(ctx.matchMutex);
-            pb::prune_old_matches(std::chrono::minutes(30));
+            std::this_thread::sleep_for(1s);
+            pb::expire_matches(std::chrono::steady_clock::now(), batch, drop_match_subscribers);
+            pb::maybe_compact_journal();
         } })
         .detach();
 
     int port = 8080;
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
 
-    if (server_fd < 0)
-    {
-        perror("socket");
-        return 1;
-    }
+    // WebSocket keepalive, in seconds; WS_PING_INTERVAL=0 disables it
+    WsHeartbeatConfig heartbeat;
+    if (const char *intervalEnv = std::getenv("WS_PING_INTERVAL"))
+        heartbeat.interval = std::chrono::seconds(std::atoi(intervalEnv));
+    if (const char *timeoutEnv = std::getenv("WS_PONG_TIMEOUT"))
+        heartbeat.timeout = std::chrono::seconds(std::max(1, std::atoi(timeoutEnv)));
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // fixed set of I/O threads, each accepting on its own SO_REUSEPORT socket;
+    // pinned one per core when there are enough cores
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned ioThreads = cores;
+    if (const char *threadsEnv = std::getenv("IO_THREADS"))
+        ioThreads = static_cast<unsigned>(std::max(1, std::atoi(threadsEnv)));
+    bool pin = ioThreads <= cores;
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-
-    if (bind(server_fd, (sockaddr *)&addr, sizeof(addr)) < 0)
-    {
-        perror("bind");
-        close(server_fd);
-        return 1;
-    }
-
-    if (listen(server_fd, SOMAXCONN) < 0)
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::vector<EventLoop *> owners;
+    for (unsigned i = 0; i < ioThreads; ++i)
     {
-        perror("listen");
-        close(server_fd);
-        return 1;
-    }
-
-    std::cout << "Listening on " << port << "\n";
-
-    while (true)
-    {
-        sockaddr_in clientAddr{};
-        socklen_t clientLen = sizeof(clientAddr);
-        int client_fd = accept(server_fd, (sockaddr *)&clientAddr, &clientLen);
-        if (client_fd < 0)
+        loops.push_back(std::make_unique<EventLoop>(heartbeat));
+        if (!loops.back()->listen(port))
         {
-            perror("accept");
-            continue;
+            perror("listen");
+            return 1;
         }
-
-        std::thread(handle_client_connection, client_fd).detach();
+        owners.push_back(loops.back().get());
     }
+    EventLoop::set_match_owners(owners);
+
+    for (unsigned i = 0; i + 1 < ioThreads; ++i)
+        std::thread(&EventLoop::run, loops[i].get(), pin ? static_cast<int>(i) : -1).detach();
+
+    std::cout << "Listening on " << port << " with " << ioThreads << " I/O threads\n";
 
-    close(server_fd);
+    // the main thread runs the last loop
+    loops.back()->run(pin ? static_cast<int>(ioThreads - 1) : -1);
     return 0;
 }
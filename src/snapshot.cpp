@@ -0,0 +1,371 @@
+#include "../include/snapshot.hpp"
+#include "../include/veto_format.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pb
+{
+    SnapshotView::~SnapshotView()
+    {
+        if (base)
+            munmap(base, length);
+    }
+
+    std::shared_ptr<const SnapshotView> SnapshotView::open(const std::string &path, std::string &error)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            error = "cannot open " + path + ": " + std::strerror(errno);
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader))
+        {
+            ::close(fd);
+            error = path + " is too short";
+            return nullptr;
+        }
+
+        std::shared_ptr<SnapshotView> view(new SnapshotView());
+        view->length = static_cast<std::size_t>(st.st_size);
+        view->base = mmap(nullptr, view->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view->base == MAP_FAILED)
+        {
+            view->base = nullptr;
+            error = "cannot map " + path + ": " + std::strerror(errno);
+            return nullptr;
+        }
+
+        const char *bytes = static_cast<const char *>(view->base);
+        view->hdr = reinterpret_cast<const SnapshotHeader *>(bytes);
+        const SnapshotHeader &h = *view->hdr;
+        if (std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0)
+        {
+            error = path + " is not a snapshot";
+            return nullptr;
+        }
+        if (h.version != SNAPSHOT_VERSION || h.recordSize != sizeof(SnapshotMatch))
+        {
+            error = path + " has snapshot version " + std::to_string(h.version) + ", expected " +
+                    std::to_string(SNAPSHOT_VERSION);
+            return nullptr;
+        }
+        const std::uint64_t recordsEnd = sizeof(SnapshotHeader) + h.matchCount * sizeof(SnapshotMatch);
+        if (h.matchCount > view->length / sizeof(SnapshotMatch) || recordsEnd > h.blobOffset ||
+            h.blobOffset > view->length || h.blobSize > view->length - h.blobOffset)
+        {
+            error = path + " is truncated";
+            return nullptr;
+        }
+
+        view->records = reinterpret_cast<const SnapshotMatch *>(bytes + sizeof(SnapshotHeader));
+        view->blob = bytes + h.blobOffset;
+        return view;
+    }
+
+    std::string_view SnapshotView::id(const SnapshotMatch &rec) const
+    {
+        const char *end = static_cast<const char *>(std::memchr(rec.id, '\0', SNAPSHOT_ID_SIZE));
+        return std::string_view(rec.id, end ? static_cast<std::size_t>(end - rec.id) : SNAPSHOT_ID_SIZE);
+    }
+
+    std::ptrdiff_t SnapshotView::find(std::string_view matchId) const
+    {
+        if (matchId.size() > SNAPSHOT_ID_SIZE)
+            return -1;
+        char key[SNAPSHOT_ID_SIZE] = {};
+        std::memcpy(key, matchId.data(), matchId.size());
+
+        const SnapshotMatch *first = records;
+        const SnapshotMatch *last = records + size();
+        const SnapshotMatch *it = std::lower_bound(first, last, key, [](const SnapshotMatch &rec, const char *k)
+                                                   { return std::memcmp(rec.id, k, SNAPSHOT_ID_SIZE) < 0; });
+        if (it == last || std::memcmp(it->id, key, SNAPSHOT_ID_SIZE) != 0)
+            return -1;
+        return it - first;
+    }
+
+    std::string_view SnapshotView::string(SnapshotRef ref, bool &ok) const
+    {
+        if (ref.offset > hdr->blobSize || ref.length > hdr->blobSize - ref.offset)
+        {
+            ok = false;
+            return std::string_view();
+        }
+        return std::string_view(blob + ref.offset, ref.length);
+    }
+
+    std::vector<int> SnapshotView::ints(SnapshotRef ref, bool &ok) const
+    {
+        if (ref.offset > hdr->blobSize || ref.length > (hdr->blobSize - ref.offset) / 4)
+        {
+            ok = false;
+            return {};
+        }
+        std::vector<int> out(ref.length);
+        for (std::size_t i = 0; i < out.size(); ++i)
+        {
+            std::int32_t v;
+            std::memcpy(&v, blob + ref.offset + i * 4, 4);
+            out[i] = v;
+        }
+        return out;
+    }
+
+    bool decode_snapshot_match(const SnapshotView &view, const SnapshotMatch &rec, Match &out)
+    {
+        bool ok = true;
+        out.id = std::string(view.id(rec));
+        out.format = find_veto_format(std::string(view.string(rec.format, ok)));
+        out.phase = static_cast<Phase>(rec.phase);
+        out.currentTurnTeam = rec.currentTurnTeam;
+        out.currentStepIndex = rec.currentStepIndex;
+        out.version = rec.version;
+        for (int t = 0; t < 2; ++t)
+        {
+            out.teams[t].name = std::string(view.string(rec.teamNames[t], ok));
+            out.teams[t].bannedMapIds = view.ints(rec.bannedMapIds[t], ok);
+            out.teams[t].pickedMapIds = view.ints(rec.pickedMapIds[t], ok);
+            out.teamCaptainTokens[t] = std::string(view.string(rec.captainTokens[t], ok));
+        }
+        out.deciderSide = rec.deciderSide;
+        out.deciderSidePickerTeam = rec.deciderSidePickerTeam;
+        out.deciderMapId = rec.deciderMapId;
+        out.currentSideMapId = rec.currentSideMapId;
+
+        SnapshotRef sidesRef = rec.mapSides;
+        sidesRef.length *= 2;
+        std::vector<int> sides = view.ints(sidesRef, ok);
+        out.mapSides.clear();
+        for (std::size_t i = 0; i + 1 < sides.size(); i += 2)
+            out.mapSides[sides[i]] = sides[i + 1];
+
+        out.stepMapIds = view.ints(rec.stepMapIds, ok);
+        out.stepSideVals = view.ints(rec.stepSideVals, ok);
+
+        if (!ok || !out.format || rec.phase > static_cast<std::uint8_t>(Phase::Completed))
+            return false;
+        const std::size_t steps = out.format->steps.size();
+        if (out.currentStepIndex > steps || out.stepMapIds.size() != steps || out.stepSideVals.size() != steps)
+            return false;
+
+        // the pool is not part of the snapshot; map ids are stable across reloads
+        out.catalog = current_map_catalog();
+        return true;
+    }
+
+    // Builds the record array and blob in memory
+    class SnapshotBuilder
+    {
+    public:
+        bool add(const Match &m)
+        {
+            if (m.id.size() > SNAPSHOT_ID_SIZE)
+                return false;
+
+            SnapshotMatch rec;
+            std::memset(&rec, 0, sizeof(rec));
+            std::memcpy(rec.id, m.id.data(), m.id.size());
+            rec.version = m.version;
+            rec.currentStepIndex = static_cast<std::uint32_t>(m.currentStepIndex);
+            rec.currentTurnTeam = m.currentTurnTeam;
+            rec.deciderSide = m.deciderSide;
+            rec.deciderSidePickerTeam = m.deciderSidePickerTeam;
+            rec.deciderMapId = m.deciderMapId;
+            rec.currentSideMapId = m.currentSideMapId;
+            rec.phase = static_cast<std::uint8_t>(m.phase);
+            rec.format = string(m.format->name);
+            for (int t = 0; t < 2; ++t)
+            {
+                rec.teamNames[t] = string(m.teams[t].name);
+                rec.captainTokens[t] = string(m.teamCaptainTokens[t]);
+                rec.bannedMapIds[t] = ints(m.teams[t].bannedMapIds);
+                rec.pickedMapIds[t] = ints(m.teams[t].pickedMapIds);
+            }
+
+            std::vector<int> sides;
+            sides.reserve(m.mapSides.size() * 2);
+            for (const auto &side : m.mapSides)
+            {
+                sides.push_back(side.first);
+                sides.push_back(side.second);
+            }
+            rec.mapSides = ints(sides);
+            rec.mapSides.length /= 2;
+
+            rec.stepMapIds = ints(m.stepMapIds);
+            rec.stepSideVals = ints(m.stepSideVals);
+            records.push_back(rec);
+            return true;
+        }
+
+        void sort()
+        {
+            std::sort(records.begin(), records.end(), [](const SnapshotMatch &a, const SnapshotMatch &b)
+                      { return std::memcmp(a.id, b.id, SNAPSHOT_ID_SIZE) < 0; });
+        }
+
+        std::vector<SnapshotMatch> records;
+        std::string blob;
+
+    private:
+        SnapshotRef string(const std::string &s)
+        {
+            SnapshotRef ref{static_cast<std::uint32_t>(blob.size()), static_cast<std::uint32_t>(s.size())};
+            blob.append(s);
+            return ref;
+        }
+
+        SnapshotRef ints(const std::vector<int> &v)
+        {
+            blob.resize((blob.size() + 3) & ~std::size_t(3)); // keep arrays 4-byte aligned
+            SnapshotRef ref{static_cast<std::uint32_t>(blob.size()), static_cast<std::uint32_t>(v.size())};
+            for (int x : v)
+            {
+                std::int32_t v32 = x;
+                blob.append(reinterpret_cast<const char *>(&v32), 4);
+            }
+            return ref;
+        }
+    };
+
+    bool write_snapshot(const std::string &path, std::uint64_t journalGeneration, std::string &error)
+    {
+        SnapshotBuilder builder;
+        std::size_t skipped = 0;
+        for_each_match([&](const Match &m)
+                       {
+            if (!builder.add(m))
+                ++skipped; });
+        builder.sort();
+        if (skipped)
+            std::cerr << "[Snapshot] Skipped " << skipped << " matches with oversized ids" << std::endl;
+
+        SnapshotHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+        h.version = SNAPSHOT_VERSION;
+        h.recordSize = sizeof(SnapshotMatch);
+        h.journalGeneration = journalGeneration;
+        h.matchCount = builder.records.size();
+        h.blobOffset = sizeof(SnapshotHeader) + builder.records.size() * sizeof(SnapshotMatch);
+        h.blobSize = builder.blob.size();
+
+        std::string tmp = path + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "wb");
+        if (!f)
+        {
+            error = "cannot create " + tmp + ": " + std::strerror(errno);
+            return false;
+        }
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  std::fwrite(builder.records.data(), sizeof(SnapshotMatch), builder.records.size(), f) == builder.records.size() &&
+                  std::fwrite(builder.blob.data(), 1, builder.blob.size(), f) == builder.blob.size() &&
+                  std::fflush(f) == 0 && fdatasync(fileno(f)) == 0;
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            error = "cannot write " + path + ": " + std::strerror(errno);
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /*
+    The snapshot being materialized. taken[i] is only touched with the shard
+    of record i locked, and records of different shards never share a byte. */
+    struct LoadedSnapshot
+    {
+        std::shared_ptr<const SnapshotView> view;
+        std::unique_ptr<std::uint8_t[]> taken;
+    };
+
+    static std::shared_ptr<LoadedSnapshot> g_snapshot;
+    static std::atomic<bool> g_snapshotPending{false}; // keeps misses cheap once warm
+
+    static std::shared_ptr<LoadedSnapshot> loaded_snapshot()
+    {
+        if (!g_snapshotPending.load(std::memory_order_acquire))
+            return nullptr;
+        return std::atomic_load(&g_snapshot);
+    }
+
+    bool load_snapshot(const std::string &path, std::uint64_t &journalGeneration,
+                       std::size_t &matchCount, std::string &error)
+    {
+        auto view = SnapshotView::open(path, error);
+        if (!view)
+            return false;
+
+        auto loaded = std::make_shared<LoadedSnapshot>();
+        loaded->taken.reset(new std::uint8_t[view->size()]());
+        loaded->view = std::move(view);
+        journalGeneration = loaded->view->header().journalGeneration;
+        matchCount = loaded->view->size();
+
+        std::atomic_store(&g_snapshot, loaded);
+        g_snapshotPending.store(true, std::memory_order_release);
+        return true;
+    }
+
+    bool take_snapshot_match(const std::string &matchId, Match &out)
+    {
+        auto loaded = loaded_snapshot();
+        if (!loaded)
+            return false;
+        std::ptrdiff_t i = loaded->view->find(matchId);
+        if (i < 0 || loaded->taken[i])
+            return false;
+        loaded->taken[i] = 1;
+
+        if (!decode_snapshot_match(*loaded->view, loaded->view->record(static_cast<std::size_t>(i)), out))
+        {
+            std::cerr << "[Snapshot] Dropping unreadable match " << matchId << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void forget_snapshot_match(const std::string &matchId)
+    {
+        auto loaded = loaded_snapshot();
+        if (!loaded)
+            return;
+        std::ptrdiff_t i = loaded->view->find(matchId);
+        if (i >= 0)
+            loaded->taken[i] = 1;
+    }
+
+    void warm_snapshot()
+    {
+        auto loaded = loaded_snapshot();
+        if (!loaded)
+            return;
+
+        // get_match pulls a record over unless the store already owns that id
+        const SnapshotView &view = *loaded->view;
+        for (std::size_t i = 0; i < view.size(); ++i)
+            get_match(std::string(view.id(view.record(i))));
+
+        discard_snapshot();
+    }
+
+    void discard_snapshot()
+    {
+        g_snapshotPending.store(false, std::memory_order_release);
+        std::atomic_store(&g_snapshot, std::shared_ptr<LoadedSnapshot>());
+    }
+}
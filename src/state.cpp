@@ -1,91 +1,272 @@
 #include "../include/state.hpp"
+#include "../include/json_writer.hpp"
+#include "../include/veto_format.hpp"
+#include "../include/timing_wheel.hpp"
+#include "../include/journal.hpp"
+#include "../include/snapshot.hpp"
+#include "../include/metrics.hpp"
 
+#include <sys/random.h>
+
+#include <cerrno>
+#include <deque>
 #include <random>
 #include <sstream>
 #include <algorithm>
+#include <array>
 
 namespace pb
 {
+    // Expiry wheel resolution; one revolution covers MATCH_TTL
+    static const std::chrono::seconds EXPIRY_TICK{2};
+    static const std::size_t EXPIRY_SLOTS = 1024;
+
+    // Id layout, see MATCH_ID_SIZE; digits double as the random alphabet
+    static const char ID_DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const std::size_t SLOT_DIGITS = 4;
+    static const std::size_t GENERATION_DIGITS = 2;
+    static const std::uint32_t GENERATION_MODULUS = 36 * 36;
+    static const std::size_t SLOTS_PER_SHARD = MAX_MATCHES / MATCH_SHARD_COUNT;
+    static const std::size_t NO_SLOT = static_cast<std::size_t>(-1);
+
+    // A recyclable home for one match; the Match keeps its buffers while free
+    struct MatchSlot
+    {
+        Match match;
+        std::uint32_t generation = 0;
+        bool live = false;
+    };
+
     // Global Storage
-    static std::unordered_map<std::string, Match> g_matches;
+    struct MatchShard
+    {
+        std::mutex mutex;
+        // slot i of this shard is global slot i * MATCH_SHARD_COUNT + shard index;
+        // a deque so matches never move while handles point at them
+        std::deque<MatchSlot> slots;
+        std::vector<std::uint32_t> freeSlots; // LIFO; may hold stale entries, see allocate_slot
+        // matches not in the slot their id names: ids that predate slot ids,
+        // or snapshot matches whose slot was reused before they were loaded
+        std::unordered_map<std::string, std::uint32_t> displaced;
+        // deadlines keyed by match id; may be stale, see expire_matches
+        TimingWheel<std::string> expiry{EXPIRY_TICK, EXPIRY_SLOTS};
+        // live matches by phase; written under the mutex, read without it by /metrics
+        std::atomic<std::size_t> phaseCounts[PHASE_COUNT] = {};
+    };
+    static MatchShard g_matches[MATCH_SHARD_COUNT];
+
+    // Lock a shard, timing the wait only when another thread holds it
+    static std::unique_lock<std::mutex> lock_shard(MatchShard &shard)
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            std::uint64_t start = metrics::now_ns();
+            lock.lock();
+            metrics::matchLockContended.add();
+            metrics::matchLockWait.observe(metrics::now_ns() - start);
+        }
+        return lock;
+    }
+
     static std::mt19937 &rng()
     {
-        static std::mt19937 gen(std::random_device{}());
+        // matches are created concurrently on different shards
+        thread_local std::mt19937 gen(std::random_device{}());
         return gen;
     }
 
+    // A byte from getrandom, drawn a buffer at a time so most ids cost no syscall
+    static unsigned char secure_random_byte()
+    {
+        thread_local unsigned char buf[256];
+        thread_local std::size_t pos = sizeof(buf);
+        if (pos == sizeof(buf))
+        {
+            std::size_t filled = 0;
+            while (filled < sizeof(buf))
+            {
+                ssize_t n = getrandom(buf + filled, sizeof(buf) - filled, 0);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    // no getrandom (very old kernel): random_device reads /dev/urandom
+                    std::random_device dev;
+                    for (; filled < sizeof(buf); ++filled)
+                        buf[filled] = static_cast<unsigned char>(dev());
+                    break;
+                }
+                filled += static_cast<std::size_t>(n);
+            }
+            pos = 0;
+        }
+        return buf[pos++];
+    }
+
     // Helpers
-    std::string generate_match_id()
+    // Fixed-width base-36, most significant digit first
+    static void write_id_digits(char *out, std::size_t value, std::size_t digits)
     {
-        static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-        std::uniform_int_distribution<> dist(0, sizeof(chars) - 2); // -2 to exclude null terminator
-        std::string s(6, '0');
-        for (char &c : s)
+        for (std::size_t i = digits; i-- > 0;)
         {
-            c = chars[dist(rng())];
+            out[i] = ID_DIGITS[value % 36];
+            value /= 36;
         }
-        return s;
     }
 
-    static std::vector<Map> get_default_maps()
-    {
-        std::vector<std::string> names = {
-            "Abyss", "Ascent", "Bind", "Haven", "Icebox", "Lotus", "Split"};
-
-        std::vector<std::string> previewUrls = {
-            "public/videos/abyss.mp4",
-            "public/videos/ascent.mp4",
-            "public/videos/bind.mp4",
-            "public/videos/havenb.mp4",
-            "public/videos/icebox.mp4",
-            "public/videos/lotus.mp4",
-            "public/videos/split.mp4"};
-        std::vector<std::string> mapImgUrls = {
-            "public/mapimgs/abyss.webp",
-            "public/mapimgs/ascent.webp",
-            "public/mapimgs/bind.webp",
-            "public/mapimgs/haven.webp",
-            "public/mapimgs/icebox.webp",
-            "public/mapimgs/lotus.webp",
-            "public/mapimgs/split.webp"};
-        std::vector<Map> result;
-        int id = 1;
-        for (uint64_t i = 0; i < names.size(); ++i)
+    std::string generate_match_id(std::size_t slot, std::uint32_t generation)
+    {
+        std::string s(MATCH_ID_SIZE, '0');
+        write_id_digits(&s[0], slot, SLOT_DIGITS);
+        write_id_digits(&s[SLOT_DIGITS], generation % GENERATION_MODULUS, GENERATION_DIGITS);
+
+        for (std::size_t i = SLOT_DIGITS + GENERATION_DIGITS; i < MATCH_ID_SIZE; ++i)
         {
-            result.push_back(Map{id++, names[i], previewUrls[i], mapImgUrls[i]});
+            // 252 = 7 * 36; rejecting the rest keeps every digit equally likely
+            unsigned char b;
+            do
+                b = secure_random_byte();
+            while (b >= 252);
+            s[i] = ID_DIGITS[b % 36];
         }
-        return result;
+        return s;
     }
 
-    static std::vector<Step> bo1_steps()
+    // Where an id lives: its shard, plus the slot and generation it names if it is a slot id
+    struct MatchLocation
     {
-        return {
-            {ActionType::Ban, TEAM_A},  // Team A Bans
-            {ActionType::Ban, TEAM_B},  // Team B Bans
-            {ActionType::Ban, TEAM_A},  // Team A Bans
-            {ActionType::Ban, TEAM_A},  // Team B Bans
-            {ActionType::Pick, TEAM_B}, // Team A Picks the Map
-            {ActionType::Side, TEAM_A}, // Team B Picks the Side
-        };
+        std::size_t shard;
+        std::size_t local = NO_SLOT; // slot within the shard
+        std::uint32_t generation = 0;
+    };
+
+    static MatchLocation locate_match(const std::string &matchId)
+    {
+        // base-36 digit values, -1 for anything else
+        static const auto digitValues = []()
+        {
+            std::array<std::int8_t, 256> t;
+            t.fill(-1);
+            for (std::size_t i = 0; i < 36; ++i)
+                t[static_cast<unsigned char>(ID_DIGITS[i])] = static_cast<std::int8_t>(i);
+            return t;
+        }();
+
+        MatchLocation loc;
+        if (matchId.size() == MATCH_ID_SIZE)
+        {
+            int bad = 0;
+            std::size_t slot = 0;
+            std::uint32_t generation = 0;
+            for (std::size_t i = 0; i < SLOT_DIGITS; ++i)
+            {
+                int d = digitValues[static_cast<unsigned char>(matchId[i])];
+                bad |= d;
+                slot = slot * 36 + static_cast<std::size_t>(d);
+            }
+            for (std::size_t i = SLOT_DIGITS; i < SLOT_DIGITS + GENERATION_DIGITS; ++i)
+            {
+                int d = digitValues[static_cast<unsigned char>(matchId[i])];
+                bad |= d;
+                generation = generation * 36 + static_cast<std::uint32_t>(d);
+            }
+            if (bad >= 0)
+            {
+                loc.shard = slot % MATCH_SHARD_COUNT;
+                loc.local = slot / MATCH_SHARD_COUNT;
+                loc.generation = generation;
+                return loc;
+            }
+        }
+        // older 6 character ids, or not an id at all
+        loc.shard = std::hash<std::string>{}(matchId) % MATCH_SHARD_COUNT;
+        return loc;
     }
 
-    static std::vector<Step> bo3_steps() // Bo3 system for valorant
+    // Index of the shard slot holding matchId: an array index and a compare, no hashing
+    // unless something is displaced; NO_SLOT if it is not in memory
+    static std::size_t find_slot(MatchShard &shard, const MatchLocation &loc, const std::string &matchId)
     {
-        return {
-            {ActionType::Ban, TEAM_A},
-            {ActionType::Ban, TEAM_B},
+        if (loc.local < shard.slots.size())
+        {
+            const MatchSlot &s = shard.slots[loc.local];
+            if (s.live && s.generation == loc.generation && s.match.id == matchId)
+                return loc.local;
+        }
+        if (shard.displaced.empty())
+            return NO_SLOT;
+        auto it = shard.displaced.find(matchId);
+        return it == shard.displaced.end() ? NO_SLOT : it->second;
+    }
 
-            {ActionType::Pick, TEAM_A}, // Team A Picks Map 1
-            {ActionType::Side, TEAM_B}, // Team B Picks Side for Map 1
+    // Index of a free slot in the shard, growing it if needed; NO_SLOT if the shard is full
+    static std::size_t allocate_slot(MatchShard &shard)
+    {
+        while (!shard.freeSlots.empty())
+        {
+            std::size_t local = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+            if (!shard.slots[local].live) // place_match may have claimed it directly
+                return local;
+        }
+        if (shard.slots.size() >= SLOTS_PER_SHARD)
+            return NO_SLOT;
+        shard.slots.emplace_back();
+        return shard.slots.size() - 1;
+    }
 
-            {ActionType::Pick, TEAM_B}, // Team B Picks Map 2
-            {ActionType::Side, TEAM_A}, // Team A Picks Side for Map 2
+    static void free_slot(MatchShard &shard, std::size_t local)
+    {
+        MatchSlot &slot = shard.slots[local];
+        if (!shard.displaced.empty())
+        {
+            auto it = shard.displaced.find(slot.match.id);
+            if (it != shard.displaced.end() && it->second == local)
+                shard.displaced.erase(it);
+        }
+        slot.live = false;
+        shard.phaseCounts[static_cast<std::size_t>(slot.match.phase)].fetch_sub(1, std::memory_order_relaxed);
+        slot.generation = (slot.generation + 1) % GENERATION_MODULUS;
+        slot.match.catalog.reset(); // do not pin a replaced map pool
+        shard.freeSlots.push_back(static_cast<std::uint32_t>(local));
+    }
 
-            {ActionType::Ban, TEAM_A},
-            {ActionType::Ban, TEAM_B},
+    // Store a match built elsewhere (replay, snapshot) in the slot its id names, or any free one
+    static MatchSlot *place_match(MatchShard &shard, const MatchLocation &loc, Match &&m)
+    {
+        const Phase phase = m.phase;
+        if (loc.local != NO_SLOT)
+        {
+            const std::size_t local = loc.local;
+            while (shard.slots.size() <= local)
+            {
+                shard.slots.emplace_back();
+                if (shard.slots.size() - 1 < local)
+                    shard.freeSlots.push_back(static_cast<std::uint32_t>(shard.slots.size() - 1));
+            }
+            // the slot takes the id's generation only if that does not move it
+            // backwards, so ids it hands out later cannot repeat earlier ones
+            MatchSlot &s = shard.slots[local];
+            if (!s.live && s.generation <= loc.generation)
+            {
+                s.live = true;
+                s.generation = loc.generation;
+                s.match = std::move(m);
+                shard.phaseCounts[static_cast<std::size_t>(phase)].fetch_add(1, std::memory_order_relaxed);
+                return &s;
+            }
+        }
 
-            {ActionType::Side, TEAM_A}, // Team A Picks Side for Decider map
-        };
+        std::size_t local = allocate_slot(shard);
+        if (local == NO_SLOT)
+            return nullptr;
+        MatchSlot &s = shard.slots[local];
+        s.live = true;
+        shard.displaced[m.id] = static_cast<std::uint32_t>(local);
+        s.match = std::move(m);
+        shard.phaseCounts[static_cast<std::size_t>(phase)].fetch_add(1, std::memory_order_relaxed);
+        return &s;
     }
 
     static bool is_map_available(const Match &m, int mapId)
@@ -112,57 +293,178 @@ namespace pb
 
     void init_state()
     {
-        g_matches.clear();
+        discard_snapshot();
+        for (auto &shard : g_matches)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.slots.clear();
+            shard.freeSlots.clear();
+            shard.displaced.clear();
+            shard.expiry.clear();
+            for (auto &count : shard.phaseCounts)
+                count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::size_t match_shard_index(const std::string &matchId)
+    {
+        return locate_match(matchId).shard;
     }
 
-    Match &create_match(const std::string &teamAName, const std::string &teamBName, std::string series)
-    {
-        Match m;
-        m.id = generate_match_id();
-        m.phase = Phase::BanPhase;
-        m.currentTurnTeam = TEAM_A;
-        m.currentStepIndex = 0; // steps are zero-indexed
-        m.availableMaps = get_default_maps();
-        m.steps = bo1_steps();
-        m.deciderMapId = 0;
-        m.deciderSide = -1;
-        m.deciderSidePickerTeam = -1;
-        m.seriesType = series;
+    MatchHandle create_match(const std::string &teamAName, const std::string &teamBName, std::string series)
+    {
+        // unknown series names fall back to bo1
+        const VetoFormat *format = find_veto_format(series);
+        if (!format)
+            format = &veto_format(SeriesFormat::Bo1);
+
+        // start at a random shard so creation spreads evenly; move on if it is full
+        const std::size_t first = rng()() % MATCH_SHARD_COUNT;
+        for (std::size_t i = 0; i < MATCH_SHARD_COUNT; ++i)
+        {
+            const std::size_t shardIndex = (first + i) % MATCH_SHARD_COUNT;
+            MatchShard &shard = g_matches[shardIndex];
+            std::unique_lock<std::mutex> lock = lock_shard(shard);
+            std::size_t local = allocate_slot(shard);
+            if (local == NO_SLOT)
+                continue;
+
+            // fill the slot in place, reusing whatever buffers its last match left behind
+            MatchSlot &slot = shard.slots[local];
+            slot.live = true;
+            Match &m = slot.match;
+            m.id = generate_match_id(local * MATCH_SHARD_COUNT + shardIndex, slot.generation);
+            m.format = format;
+            m.phase = format->phaseAt[0];
+            m.currentTurnTeam = format->steps[0].teamIndex;
+            m.currentStepIndex = 0; // steps are zero-indexed
+            m.version = 0;
+            m.catalog = current_map_catalog();
+            m.deciderMapId = 0;
+            m.deciderSide = -1;
+            m.deciderSidePickerTeam = -1;
+            m.mapSides.clear();
+            m.currentSideMapId = 0;
+            m.lastUpdated = std::chrono::steady_clock::now();
+            m.teamCaptainTokens[TEAM_A].clear();
+            m.teamCaptainTokens[TEAM_B].clear();
+
+            m.wsUncompressedBytes = 0;
+            m.wsSentBytes = 0;
+
+            m.stepMapIds.assign(m.format->steps.size(), pb::UNASSIGNED_MAP_ID);
+            m.stepSideVals.assign(m.format->steps.size(), -1);
+
+            m.teams[TEAM_A].name = teamAName;
+            m.teams[TEAM_B].name = teamBName;
+            for (Team &team : m.teams)
+            {
+                team.bannedMapIds.clear();
+                team.pickedMapIds.clear();
+            }
+
+            forget_snapshot_match(m.id);
+            shard.expiry.schedule(m.lastUpdated + MATCH_TTL, m.id);
+            shard.phaseCounts[static_cast<std::size_t>(m.phase)].fetch_add(1, std::memory_order_relaxed);
+            journal_match(m);
+            return MatchHandle(std::move(lock), &m, shard.phaseCounts);
+        }
+        return MatchHandle();
+    }
+
+    MatchHandle get_match(const std::string &matchId)
+    {
+        const MatchLocation loc = locate_match(matchId);
+        MatchShard &shard = g_matches[loc.shard];
+        std::unique_lock<std::mutex> lock = lock_shard(shard);
+        std::size_t local = find_slot(shard, loc, matchId);
+        if (local != NO_SLOT)
+        {
+            return MatchHandle(std::move(lock), &shard.slots[local].match, shard.phaseCounts);
+        }
+
+        // after a restart, matches stay in the mapped snapshot until first use
+        Match restored;
+        if (!take_snapshot_match(matchId, restored))
+            return MatchHandle();
+        restored.lastUpdated = std::chrono::steady_clock::now();
+        MatchSlot *slot = place_match(shard, loc, std::move(restored));
+        if (!slot)
+            return MatchHandle();
+        shard.expiry.schedule(slot->match.lastUpdated + MATCH_TTL, matchId);
+        return MatchHandle(std::move(lock), &slot->match, shard.phaseCounts);
+    }
+
+    MatchHandle restore_match(Match m)
+    {
         m.lastUpdated = std::chrono::steady_clock::now();
-        m.teamCaptainTokens[TEAM_A].clear();
-        m.teamCaptainTokens[TEAM_B].clear();
 
-        if (series == "bo3")
+        const MatchLocation loc = locate_match(m.id);
+        MatchShard &shard = g_matches[loc.shard];
+        std::unique_lock<std::mutex> lock = lock_shard(shard);
+        forget_snapshot_match(m.id);
+        std::size_t local = find_slot(shard, loc, m.id);
+        if (local != NO_SLOT)
         {
-            m.steps = bo3_steps();
+            Match &stored = shard.slots[local].match;
+            shard.phaseCounts[static_cast<std::size_t>(stored.phase)].fetch_sub(1, std::memory_order_relaxed);
+            shard.phaseCounts[static_cast<std::size_t>(m.phase)].fetch_add(1, std::memory_order_relaxed);
+            stored = std::move(m);
+            return MatchHandle(std::move(lock), &stored, shard.phaseCounts);
         }
 
-        m.stepMapIds.assign(m.steps.size(), pb::UNASSIGNED_MAP_ID);
-        m.stepSideVals.assign(m.steps.size(), -1);
+        auto deadline = m.lastUpdated + MATCH_TTL;
+        MatchSlot *slot = place_match(shard, loc, std::move(m));
+        if (!slot)
+            return MatchHandle();
+        shard.expiry.schedule(deadline, slot->match.id);
+        return MatchHandle(std::move(lock), &slot->match, shard.phaseCounts);
+    }
 
-        m.teams[TEAM_A].name = teamAName;
-        m.teams[TEAM_B].name = teamBName;
+    bool erase_match(const std::string &matchId)
+    {
+        // the expiry entry goes stale and is dropped when it comes due
+        const MatchLocation loc = locate_match(matchId);
+        MatchShard &shard = g_matches[loc.shard];
+        std::unique_lock<std::mutex> lock = lock_shard(shard);
+        forget_snapshot_match(matchId);
+        std::size_t local = find_slot(shard, loc, matchId);
+        if (local == NO_SLOT)
+            return false;
+        free_slot(shard, local);
+        return true;
+    }
 
-        g_matches[m.id] = m;
-        return g_matches[m.id];
+    void for_each_match(const std::function<void(const Match &)> &fn)
+    {
+        warm_snapshot();
+        for (auto &shard : g_matches)
+        {
+            std::unique_lock<std::mutex> lock = lock_shard(shard);
+            for (const MatchSlot &slot : shard.slots)
+            {
+                if (slot.live)
+                    fn(slot.match);
+            }
+        }
     }
 
-    Match *get_match(const std::string &matchId)
+    void count_matches_by_phase(std::size_t counts[PHASE_COUNT])
     {
-        auto it = g_matches.find(matchId);
-        if (it != g_matches.end())
+        for (auto &shard : g_matches)
         {
-            return &it->second;
+            for (std::size_t p = 0; p < PHASE_COUNT; ++p)
+                counts[p] += shard.phaseCounts[p].load(std::memory_order_relaxed);
         }
-        return nullptr;
     }
 
     bool apply_action(Match &m, int teamIndex, ActionType action, int mapId)
     {
-        if (m.phase == Phase::Completed || m.currentStepIndex >= m.steps.size())
+        const VetoFormat &format = *m.format;
+        if (m.phase == Phase::Completed || m.currentStepIndex >= format.steps.size())
             return false;
 
-        const Step &currentStep = m.steps[m.currentStepIndex];
+        const Step &currentStep = format.steps[m.currentStepIndex];
         if (currentStep.teamIndex != teamIndex || currentStep.action != action)
             return false;
 
@@ -184,8 +486,8 @@ namespace pb
         else if (action == ActionType::Side)
         {
             const int side = mapId; // mapId arg is treated as side (0 or 1) here
-            // If this is the decider map (last step), record it specifically
-            if (m.seriesType == "bo1") {
+            // If this is the decider map, record it specifically
+            if (format.decider == DeciderRule::PickedMap) {
                  m.deciderSide = side;
                  m.deciderSidePickerTeam = teamIndex;
                  m.deciderMapId = m.currentSideMapId; 
@@ -208,27 +510,22 @@ namespace pb
         m.currentStepIndex++;
 
         // check completion
-        if (m.currentStepIndex >= m.steps.size())
+        m.phase = format.phaseAt[m.currentStepIndex];
+        if (m.currentStepIndex >= format.steps.size())
         {
-            m.phase = Phase::Completed;
-            
-            // Logic for bo1: each side bans 2, team a picks the map
-            if (m.seriesType == "bo1" && m.deciderMapId == 0) {
-                 if (!m.teams[TEAM_B].pickedMapIds.empty()) {
-                    m.deciderMapId = m.teams[TEAM_B].pickedMapIds[0];
-                }
+            // picked-map formats: the last picked map is the decider
+            if (format.decider == DeciderRule::PickedMap && m.deciderMapId == 0) {
+                m.deciderMapId = m.currentSideMapId;
             }
         }
         else
         {
-            const auto &nextStep = m.steps[m.currentStepIndex];
-            
-            m.currentTurnTeam = nextStep.teamIndex;
+            m.currentTurnTeam = format.steps[m.currentStepIndex].teamIndex;
 
-            // calculate decider map if we are at the last step of bo3
-            if (m.seriesType == "bo3" && m.currentStepIndex == m.steps.size() - 1)
+            // the map left over before the final side step becomes the decider
+            if (format.decider == DeciderRule::RemainingMap && m.currentStepIndex == format.deciderStep)
             {
-                for (const auto &map : m.availableMaps)
+                for (const auto &map : m.catalog->maps)
                 {
                     if (is_map_available(m, map.id))
                     {
@@ -239,190 +536,211 @@ namespace pb
                     }
                 }
             }
-            if (nextStep.action == ActionType::Pick)
-                m.phase = Phase::PickPhase;
-            else if (nextStep.action == ActionType::Side)
-                m.phase = Phase::SidePhase;
-            else
-                m.phase = Phase::BanPhase;
         }
 
+        m.version++;
         m.lastUpdated = std::chrono::steady_clock::now();
         return true;
     }
 
-    std::string match_to_json(const Match &m)
+    // Fields shared by the full and light renderings
+    static void write_match_header(JsonWriter &w, const Match &m)
+    {
+        w.raw("\"id\":");
+        w.string(m.id);
+        w.raw(",\"version\":");
+        w.integer(m.version);
+        w.raw(",\"phase\":");
+        w.integer(static_cast<int>(m.phase));
+        w.raw(",\"currentTurnTeam\":");
+        w.integer(m.currentTurnTeam);
+        w.raw(",\"currentStepIndex\":");
+        w.integer(m.currentStepIndex);
+        w.raw(",\"deciderMapId\":");
+        w.integer(m.deciderMapId);
+    }
+
+    static void write_captain_taken(JsonWriter &w, const Match &m)
     {
-        std::ostringstream oss;
-        oss << "{";
-        oss << "\"id\":\"" << m.id << "\",";
-        oss << "\"phase\":" << static_cast<int>(m.phase) << ",";
-        oss << "\"currentTurnTeam\":" << m.currentTurnTeam << ",";
-        oss << "\"currentStepIndex\":" << m.currentStepIndex << ",";
-        oss << "\"deciderMapId\":" << m.deciderMapId << ",";
-        std::string seriesType = m.seriesType;
-        oss << "\"seriesType\":\"" << seriesType << "\",";
-        oss << "\"captainTaken\":["
-            << (m.teamCaptainTokens[0].empty() ? false : true) << ","
-            << (m.teamCaptainTokens[1].empty() ? false : true) << "],";
-        oss << "\"deciderSide\":" << m.deciderSide << ",";
-        oss << "\"deciderSidePickerTeam\":" << m.deciderSidePickerTeam << ",";
-        oss << "\"teams\":[";
+        w.raw("\"captainTaken\":[");
+        w.raw(m.teamCaptainTokens[0].empty() ? '0' : '1');
+        w.raw(',');
+        w.raw(m.teamCaptainTokens[1].empty() ? '0' : '1');
+        w.raw(']');
+    }
+
+    static void write_decider_side(JsonWriter &w, const Match &m)
+    {
+        w.raw("\"deciderSide\":");
+        w.integer(m.deciderSide);
+        w.raw(",\"deciderSidePickerTeam\":");
+        w.integer(m.deciderSidePickerTeam);
+    }
+
+    static void write_teams(JsonWriter &w, const Match &m, bool withNames)
+    {
+        w.raw("\"teams\":[");
         for (int i = 0; i < 2; ++i)
         {
             const Team &team = m.teams[i];
-            oss << "{";
-            oss << "\"name\":\"" << team.name << "\",";
-
-            oss << "\"bannedMapIds\":[";
-            for (size_t j = 0; j < team.bannedMapIds.size(); ++j)
+            w.raw(i ? ",{" : "{");
+            if (withNames)
             {
-                oss << team.bannedMapIds[j];
-                if (j + 1 < team.bannedMapIds.size())
-                    oss << ",";
+                w.raw("\"name\":");
+                w.string(team.name);
+                w.raw(',');
             }
-            oss << "],";
-
-            oss << "\"pickedMapIds\":[";
-            for (size_t j = 0; j < team.pickedMapIds.size(); ++j)
-            {
-                oss << team.pickedMapIds[j];
-                if (j + 1 < team.pickedMapIds.size())
-                    oss << ",";
-            }
-            oss << "]";
-
-            oss << "}";
-            if (i + 1 < 2)
-                oss << ",";
-        }
-        oss << "],";
-        oss << "\"availableMaps\":[";
-        for (size_t i = 0; i < m.availableMaps.size(); ++i)
-        {
-            const Map &map = m.availableMaps[i];
-            oss << "{";
-            oss << "\"id\":" << map.id << ",";
-            oss << "\"name\":\"" << map.name << "\",";
-            oss << "\"previewUrl\":\"" << map.previewUrl << "\",";
-            oss << "\"mapImgUrl\":\"" << map.mapImgUrl << "\"";
-            oss << "}";
-            if (i + 1 < m.availableMaps.size())
-                oss << ",";
+            w.raw("\"bannedMapIds\":");
+            w.int_array(team.bannedMapIds);
+            w.raw(",\"pickedMapIds\":");
+            w.int_array(team.pickedMapIds);
+            w.raw('}');
         }
+        w.raw(']');
+    }
 
-        oss << "],";
-        oss << "\"stepMapIds\":[";
-        for (size_t i = 0; i < m.stepMapIds.size(); ++i)
-        {
-            oss << m.stepMapIds[i];
-            if (i + 1 < m.stepMapIds.size())
-                oss << ",";
-        }
-        oss << "],";
+    static void write_step_values(JsonWriter &w, const Match &m)
+    {
+        w.raw("\"stepMapIds\":");
+        w.int_array(m.stepMapIds);
+        w.raw(",\"stepSideVals\":");
+        w.int_array(m.stepSideVals);
+    }
 
-        oss << "\"stepSideVals\":[";
-        for (size_t i = 0; i < m.stepSideVals.size(); ++i)
-        {
-            oss << m.stepSideVals[i];
-            if (i + 1 < m.stepSideVals.size())
-                oss << ",";
-        }
-        oss << "],";
-        oss << "\"steps\":[";
-        for (size_t i = 0; i < m.steps.size(); ++i)
-        {
-            oss << "{";
-            oss << "\"action\":" << static_cast<int>(m.steps[i].action) << ",";
-            oss << "\"teamIndex\":" << m.steps[i].teamIndex;
-            oss << "}";
-            if (i + 1 < m.steps.size())
-                oss << ",";
-        }
-        oss << "]";
-        oss << "}";
-        return oss.str();
+    void append_match_json(const Match &m, std::string &out)
+    {
+        JsonWriter w(out);
+        w.raw('{');
+        write_match_header(w, m);
+        w.raw(",\"seriesType\":");
+        w.string(m.format->name);
+        w.raw(',');
+        write_captain_taken(w, m);
+        w.raw(',');
+        write_decider_side(w, m);
+        w.raw(',');
+        write_teams(w, m, true);
+        w.raw(',');
+        w.raw(m.catalog->mapsJson);
+        w.raw(',');
+        write_step_values(w, m);
+        w.raw(',');
+        w.raw(m.format->stepsJson);
+        w.raw('}');
     }
+
+    std::string match_to_json(const Match &m)
+    {
+        std::string out;
+        out.reserve(512 + m.catalog->mapsJson.size() + m.format->stepsJson.size());
+        append_match_json(m, out);
+        return out;
+    }
+
     std::string match_to_light_json(const Match &m)
-{
-    std::ostringstream oss;
-    oss << "{";
-    oss << "\"id\":\"" << m.id << "\",";
-    oss << "\"phase\":" << static_cast<int>(m.phase) << ",";
-    oss << "\"currentTurnTeam\":" << m.currentTurnTeam << ",";
-    oss << "\"currentStepIndex\":" << m.currentStepIndex << ",";
-    oss << "\"deciderMapId\":" << m.deciderMapId << ",";
-    
-    oss << "\"deciderSide\":" << m.deciderSide << ",";
-    oss << "\"deciderSidePickerTeam\":" << m.deciderSidePickerTeam << ",";
-
-    oss << "\"captainTaken\":["
-        << (m.teamCaptainTokens[0].empty() ? false : true) << ","
-        << (m.teamCaptainTokens[1].empty() ? false : true) << "],";
-
-    oss << "\"teams\":[";
-    for (int i = 0; i < 2; ++i)
-    {
-        const Team &team = m.teams[i];
-        oss << "{";
-
-        oss << "\"bannedMapIds\":[";
-        for (size_t j = 0; j < team.bannedMapIds.size(); ++j)
+    {
+        std::string out;
+        out.reserve(512);
+        JsonWriter w(out);
+        w.raw('{');
+        write_match_header(w, m);
+        w.raw(',');
+        write_decider_side(w, m);
+        w.raw(',');
+        write_captain_taken(w, m);
+        w.raw(',');
+        write_teams(w, m, false);
+        w.raw(',');
+        write_step_values(w, m);
+        w.raw('}');
+        return out;
+    }
+
+    std::string match_to_patch_json(const Match &m, std::size_t stepIdx)
+    {
+        std::string out;
+        out.reserve(256);
+        JsonWriter w(out);
+        w.raw("{\"type\":\"patch\",");
+        write_match_header(w, m);
+        w.raw(',');
+        write_decider_side(w, m);
+
+        // [stepIndex, mapId, sideVal] for the applied step, plus the next step
+        // when the decider map was filled in ahead of its side choice
+        w.raw(",\"steps\":[");
+        for (std::size_t i = stepIdx; i < m.stepMapIds.size() && i <= stepIdx + 1; ++i)
         {
-            oss << team.bannedMapIds[j];
-            if (j + 1 < team.bannedMapIds.size()) oss << ",";
+            if (i > stepIdx)
+            {
+                if (m.stepMapIds[i] == UNASSIGNED_MAP_ID)
+                    break;
+                w.raw(',');
+            }
+            w.raw('[');
+            w.integer(i);
+            w.raw(',');
+            w.integer(m.stepMapIds[i]);
+            w.raw(',');
+            w.integer(m.stepSideVals[i]);
+            w.raw(']');
         }
-        oss << "],";
+        w.raw(']');
 
-        oss << "\"pickedMapIds\":[";
-        for (size_t j = 0; j < team.pickedMapIds.size(); ++j)
+        // ban/pick steps append one map to a team's list: [teamIndex, mapId]
+        const Step &step = m.format->steps[stepIdx];
+        if (step.action == ActionType::Ban || step.action == ActionType::Pick)
         {
-            oss << team.pickedMapIds[j];
-            if (j + 1 < team.pickedMapIds.size()) oss << ",";
+            w.raw(step.action == ActionType::Ban ? ",\"ban\":[" : ",\"pick\":[");
+            w.integer(step.teamIndex);
+            w.raw(',');
+            w.integer(m.stepMapIds[stepIdx]);
+            w.raw(']');
         }
-        oss << "]";
-        oss << "}";
-        if (i + 1 < 2) oss << ",";
-    }
-    oss << "],";
 
-    oss << "\"stepMapIds\":[";
-    for (size_t i = 0; i < m.stepMapIds.size(); ++i)
-    {
-        oss << m.stepMapIds[i];
-        if (i + 1 < m.stepMapIds.size()) oss << ",";
+        w.raw('}');
+        return out;
     }
-    oss << "],";
 
-    oss << "\"stepSideVals\":[";
-    for (size_t i = 0; i < m.stepSideVals.size(); ++i)
+    std::size_t expire_matches(std::chrono::steady_clock::time_point now, std::size_t maxBatch,
+                               const MatchExpiredFn &onExpired)
     {
-        oss << m.stepSideVals[i];
-        if (i + 1 < m.stepSideVals.size()) oss << ",";
-    }
-    oss << "]"; 
+        std::vector<std::string> expired;
+        std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>> renewed;
 
-    oss << "}";
-    return oss.str();
-}
+        for (auto &shard : g_matches)
+        {
+            std::unique_lock<std::mutex> lock = lock_shard(shard);
+
+            // actions only bump lastUpdated; a due entry whose match has been
+            // touched since it was scheduled is moved to the new deadline
+            shard.expiry.advance(now, maxBatch, [&](std::string &&id)
+                                 {
+                std::size_t local = find_slot(shard, locate_match(id), id);
+                if (local == NO_SLOT)
+                    return;
+                auto deadline = shard.slots[local].match.lastUpdated + MATCH_TTL;
+                if (deadline > now)
+                {
+                    renewed.emplace_back(deadline, std::move(id));
+                    return;
+                }
+                free_slot(shard, local);
+                journal_expire(id);
+                expired.push_back(std::move(id)); });
 
-    void prune_old_matches(std::chrono::seconds maxAge)
-    {
-        auto now = std::chrono::steady_clock::now();
+            for (auto &entry : renewed)
+                shard.expiry.schedule(entry.first, std::move(entry.second));
+            renewed.clear();
+        }
 
-        for (auto it = g_matches.begin(); it != g_matches.end();)
+        for (const auto &id : expired)
         {
-            auto age = now - it->second.lastUpdated;
-            if (age > maxAge)
-            {
-                std::cout << "[Cleanup] Deleting expired match ID: " << it->second.id << std::endl;  
-                it = g_matches.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
+            std::cout << "[Cleanup] Deleting expired match ID: " << id << std::endl;
+            if (onExpired)
+                onExpired(id);
         }
+        return expired.size();
     }
 
-}
\ No newline at end of file
+}
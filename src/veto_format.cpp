@@ -0,0 +1,299 @@
+#include "../include/veto_format.hpp"
+#include "../include/json_writer.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <sstream>
+
+namespace pb
+{
+    constexpr Step BO1_STEPS[] = {
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Ban, TEAM_B},
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Pick, TEAM_B}, // Team B picks the map
+        {ActionType::Side, TEAM_A}, // Team A picks the side
+    };
+
+    constexpr Step BO3_STEPS[] = { // Bo3 system for valorant
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Ban, TEAM_B},
+
+        {ActionType::Pick, TEAM_A}, // Team A Picks Map 1
+        {ActionType::Side, TEAM_B}, // Team B Picks Side for Map 1
+
+        {ActionType::Pick, TEAM_B}, // Team B Picks Map 2
+        {ActionType::Side, TEAM_A}, // Team A Picks Side for Map 2
+
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Ban, TEAM_B},
+
+        {ActionType::Side, TEAM_A}, // Team A Picks Side for Decider map
+    };
+
+    constexpr Step BO5_STEPS[] = {
+        {ActionType::Ban, TEAM_A},
+        {ActionType::Ban, TEAM_B},
+
+        {ActionType::Pick, TEAM_A}, // Map 1
+        {ActionType::Side, TEAM_B},
+        {ActionType::Pick, TEAM_B}, // Map 2
+        {ActionType::Side, TEAM_A},
+        {ActionType::Pick, TEAM_A}, // Map 3
+        {ActionType::Side, TEAM_B},
+        {ActionType::Pick, TEAM_B}, // Map 4
+        {ActionType::Side, TEAM_A},
+
+        {ActionType::Side, TEAM_A}, // Team A Picks Side for Decider map
+    };
+
+    template <std::size_t N>
+    constexpr bool ends_with_side(const Step (&steps)[N])
+    {
+        return steps[N - 1].action == ActionType::Side;
+    }
+
+    static_assert(ends_with_side(BO1_STEPS), "bo1 ends with the side choice for the picked map");
+    static_assert(ends_with_side(BO3_STEPS), "bo3 ends with the decider side choice");
+    static_assert(ends_with_side(BO5_STEPS), "bo5 ends with the decider side choice");
+
+    static Phase phase_for(ActionType action)
+    {
+        switch (action)
+        {
+        case ActionType::Pick:
+            return Phase::PickPhase;
+        case ActionType::Side:
+            return Phase::SidePhase;
+        default:
+            return Phase::BanPhase;
+        }
+    }
+
+    static bool validate_steps(DeciderRule decider, const std::vector<Step> &steps, std::string &error)
+    {
+        if (steps.empty())
+        {
+            error = "format has no steps";
+            return false;
+        }
+
+        bool sawPick = false;
+        for (std::size_t i = 0; i < steps.size(); ++i)
+        {
+            const Step &step = steps[i];
+            if (step.teamIndex != TEAM_A && step.teamIndex != TEAM_B)
+            {
+                error = "step " + std::to_string(i) + " has an invalid team";
+                return false;
+            }
+            bool deciderSide = decider == DeciderRule::RemainingMap && i + 1 == steps.size();
+            if (step.action == ActionType::Side && !deciderSide &&
+                (i == 0 || steps[i - 1].action != ActionType::Pick))
+            {
+                error = "side step " + std::to_string(i) + " does not follow a pick";
+                return false;
+            }
+            sawPick |= step.action == ActionType::Pick;
+        }
+
+        if (steps.back().action != ActionType::Side)
+        {
+            error = "format must end with a side choice";
+            return false;
+        }
+        if (decider == DeciderRule::PickedMap && !sawPick)
+        {
+            error = "picked-map decider needs at least one pick";
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t maps_needed(DeciderRule decider, const std::vector<Step> &steps)
+    {
+        std::size_t n = decider == DeciderRule::RemainingMap ? 1 : 0;
+        for (const Step &step : steps)
+        {
+            if (step.action != ActionType::Side)
+                ++n;
+        }
+        return n;
+    }
+
+    static VetoFormat make_format(const std::string &name, SeriesFormat series,
+                                  DeciderRule decider, std::vector<Step> steps)
+    {
+        VetoFormat f;
+        f.name = name;
+        f.series = series;
+        f.decider = decider;
+        f.steps = std::move(steps);
+        f.deciderStep = f.steps.size() - 1;
+
+        for (const Step &step : f.steps)
+            f.phaseAt.push_back(phase_for(step.action));
+        f.phaseAt.push_back(Phase::Completed);
+
+        JsonWriter w(f.stepsJson);
+        w.raw("\"steps\":[");
+        for (std::size_t i = 0; i < f.steps.size(); ++i)
+        {
+            if (i)
+                w.raw(',');
+            w.raw("{\"action\":");
+            w.integer(static_cast<int>(f.steps[i].action));
+            w.raw(",\"teamIndex\":");
+            w.integer(f.steps[i].teamIndex);
+            w.raw('}');
+        }
+        w.raw(']');
+        return f;
+    }
+
+    template <std::size_t N>
+    static std::vector<Step> to_vector(const Step (&steps)[N])
+    {
+        return std::vector<Step>(steps, steps + N);
+    }
+
+    // deque keeps addresses stable as custom formats are appended
+    static std::deque<VetoFormat> &registry()
+    {
+        static std::deque<VetoFormat> formats = {
+            make_format("bo1", SeriesFormat::Bo1, DeciderRule::PickedMap, to_vector(BO1_STEPS)),
+            make_format("bo3", SeriesFormat::Bo3, DeciderRule::RemainingMap, to_vector(BO3_STEPS)),
+            make_format("bo5", SeriesFormat::Bo5, DeciderRule::RemainingMap, to_vector(BO5_STEPS)),
+        };
+        return formats;
+    }
+
+    const VetoFormat &veto_format(SeriesFormat series)
+    {
+        // built-ins are registered first, in enum order; Custom has no single format
+        return registry()[static_cast<std::size_t>(series == SeriesFormat::Custom ? SeriesFormat::Bo1 : series)];
+    }
+
+    const VetoFormat *find_veto_format(const std::string &name)
+    {
+        for (const VetoFormat &f : registry())
+        {
+            if (f.name == name)
+                return &f;
+        }
+        return nullptr;
+    }
+
+    std::size_t max_maps_needed()
+    {
+        std::size_t n = 0;
+        for (const VetoFormat &f : registry())
+            n = std::max(n, maps_needed(f.decider, f.steps));
+        return n;
+    }
+
+    const VetoFormat *register_veto_format(const std::string &name, DeciderRule decider,
+                                           const std::vector<Step> &steps, std::string &error)
+    {
+        if (name.empty() || find_veto_format(name))
+        {
+            error = "format name '" + name + "' is empty or already registered";
+            return nullptr;
+        }
+        if (!validate_steps(decider, steps, error))
+        {
+            error = name + ": " + error;
+            return nullptr;
+        }
+        // a veto that runs out of maps would stop partway with no legal action
+        std::size_t needed = maps_needed(decider, steps);
+        std::size_t available = current_map_catalog()->maps.size();
+        if (needed > available)
+        {
+            error = name + ": needs " + std::to_string(needed) + " maps but the map pool has " +
+                    std::to_string(available);
+            return nullptr;
+        }
+
+        registry().push_back(make_format(name, SeriesFormat::Custom, decider, steps));
+        return &registry().back();
+    }
+
+    static bool parse_step(const std::string &token, Step &out)
+    {
+        std::size_t colon = token.find(':');
+        if (colon == std::string::npos || colon + 2 != token.size())
+            return false;
+
+        std::string action = token.substr(0, colon);
+        if (action == "ban")
+            out.action = ActionType::Ban;
+        else if (action == "pick")
+            out.action = ActionType::Pick;
+        else if (action == "side")
+            out.action = ActionType::Side;
+        else
+            return false;
+
+        char team = token[colon + 1];
+        if (team != 'A' && team != 'B')
+            return false;
+        out.teamIndex = team == 'A' ? TEAM_A : TEAM_B;
+        return true;
+    }
+
+    bool load_veto_formats(const std::string &path, std::string &error)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        std::string line;
+        int lineNo = 0;
+        while (std::getline(in, line))
+        {
+            ++lineNo;
+            std::istringstream fields(line);
+            std::string name, rule, token;
+            if (!(fields >> name) || name[0] == '#')
+                continue;
+
+            std::string where = path + ":" + std::to_string(lineNo) + ": ";
+            DeciderRule decider;
+            fields >> rule;
+            if (rule == "picked")
+                decider = DeciderRule::PickedMap;
+            else if (rule == "remaining")
+                decider = DeciderRule::RemainingMap;
+            else
+            {
+                error = where + "decider rule must be 'picked' or 'remaining'";
+                return false;
+            }
+
+            std::vector<Step> steps;
+            while (fields >> token)
+            {
+                Step step;
+                if (!parse_step(token, step))
+                {
+                    error = where + "bad step '" + token + "', expected e.g. ban:A";
+                    return false;
+                }
+                steps.push_back(step);
+            }
+
+            if (!register_veto_format(name, decider, steps, error))
+            {
+                error = where + error;
+                return false;
+            }
+        }
+        return true;
+    }
+}
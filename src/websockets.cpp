@@ -1,5 +1,20 @@
 #include "../include/websockets.hpp"
 
+#include <atomic>
+
+static std::atomic<uint64_t> g_egressMessages{0};
+static std::atomic<uint64_t> g_egressDeflated{0};
+static std::atomic<uint64_t> g_egressUncompressed{0};
+static std::atomic<uint64_t> g_egressSent{0};
+
+static void count_egress(uint64_t messages, uint64_t deflated, uint64_t uncompressed, uint64_t sent)
+{
+    g_egressMessages.fetch_add(messages, std::memory_order_relaxed);
+    g_egressDeflated.fetch_add(deflated, std::memory_order_relaxed);
+    g_egressUncompressed.fetch_add(uncompressed, std::memory_order_relaxed);
+    g_egressSent.fetch_add(sent, std::memory_order_relaxed);
+}
+
 // helper for encoding base64
 std::string base64_encode(const unsigned char *data, size_t len)
 {
@@ -20,70 +35,16 @@ std::string base64_encode(const unsigned char *data, size_t len)
     return out;
 }
 
-bool is_websocket_upgrade(const std::string &raw, std::string &secKeyOut)
+bool is_websocket_upgrade(const HttpRequest &req)
 {
-    std::istringstream iss(raw);
-    std::string line;
-
-    bool hasUpgrade = false;
-    bool hasConnection = false;
-    std::string secKey;
-
-    // skip request line, start from headers
-    std::getline(iss, line);
-
-    while (std::getline(iss, line))
-    {
-        if (line == "\r" || line.empty())
-            break;
-
-        auto pos = line.find(':');
-        if (pos == std::string::npos)
-            continue;
-        std::string name = line.substr(0, pos);
-        std::string value = line.substr(pos + 1);
-        // trim
-        auto trim = [](std::string &s)
-        {
-            while (!s.empty() && (s.back() == '\r' || s.back() == '\n' || s.back() == ' ' || s.back() == '\t'))
-                s.pop_back();
-            size_t i = 0;
-            while (i < s.size() && (s[i] == ' ' || s[i] == '\t'))
-                ++i;
-            s.erase(0, i);
-        };
-        trim(name);
-        trim(value);
-
-        std::string lowerName = name;
-        std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
-
-        if (lowerName == "upgrade" && value.find("websocket") != std::string::npos)
-        {
-            hasUpgrade = true;
-        }
-        if (lowerName == "connection" && value.find("Upgrade") != std::string::npos)
-        {
-            hasConnection = true;
-        }
-        if (lowerName == "sec-websocket-key")
-        {
-            secKey = value;
-        }
-    }
-
-    if (hasUpgrade && hasConnection && !secKey.empty())
-    {
-        secKeyOut = secKey;
-        return true;
-    }
-    return false;
+    return req.upgradeWebsocket && req.connectionUpgrade && !req.secWebSocketKey.empty();
 }
 
-std::string compute_websocket_accept(const std::string &secKey)
+std::string compute_websocket_accept(std::string_view secKey)
 {
     static const std::string GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-    std::string toHash = secKey + GUID;
+    std::string toHash(secKey);
+    toHash += GUID;
 
     unsigned char sha1[SHA_DIGEST_LENGTH];
     SHA1(reinterpret_cast<const unsigned char *>(toHash.data()), toHash.size(), sha1);
@@ -91,100 +52,108 @@ std::string compute_websocket_accept(const std::string &secKey)
     return base64_encode(sha1, SHA_DIGEST_LENGTH);
 }
 
-bool recv_ws_frame(int fd, std::string &outPayload)
+WsOutFrame make_ws_frame(uint8_t opcode, SharedBuffer payload, bool compressed)
 {
-    uint8_t header[2];
-    int n = recv(fd, header, 2, 0);
-    if (n <= 0)
-        return false;
+    uint8_t header[10];
+    uint64_t len = payload->size();
+    size_t headerLen = 0;
 
-    [[maybe_unused]] bool fin = (header[0] & 0x80) != 0;
-    uint8_t opcode = header[0] & 0x0F;
-    bool mask = (header[1] & 0x80) != 0;
-    uint64_t len = header[1] & 0x7F;
+    header[0] = 0x80 | opcode; // FIN=1, unfragmented
+    if (compressed)
+        header[0] |= 0x40; // RSV1
 
-    if (!mask)
+    if (len <= 125)
     {
-        // Client frames MUST be masked
-        return false;
+        header[1] = static_cast<uint8_t>(len);
+        headerLen = 2;
     }
-
-    if (len == 126)
+    else if (len < 65536)
     {
-        uint8_t ext[2];
-        n = recv(fd, ext, 2, 0);
-        if (n <= 0)
-            return false;
-        len = (ext[0] << 8) | ext[1];
+        header[1] = 126;
+        header[2] = (len >> 8) & 0xFF;
+        header[3] = len & 0xFF;
+        headerLen = 4;
     }
-    else if (len == 127)
+    else
     {
-        // skipping 64-bit payloads for brevity
-        return false;
+        header[1] = 127;
+        for (int i = 0; i < 8; ++i)
+            header[2 + i] = (len >> (56 - 8 * i)) & 0xFF;
+        headerLen = 10;
     }
 
-    uint8_t maskKey[4];
-    n = recv(fd, maskKey, 4, 0);
-    if (n <= 0)
-        return false;
+    WsOutFrame frame;
+    frame.header = std::make_shared<const std::string>(reinterpret_cast<const char *>(header), headerLen);
+    frame.payload = std::move(payload);
+    return frame;
+}
 
-    std::string payload(len, '\0');
-    size_t received = 0;
-    while (received < len)
-    {
-        n = recv(fd, &payload[received], len - received, 0);
-        if (n <= 0)
-            return false;
-        received += n;
-    }
+WsOutFrame make_ws_frame(uint8_t opcode, std::string payload)
+{
+    return make_ws_frame(opcode, std::make_shared<const std::string>(std::move(payload)));
+}
 
-    for (uint64_t i = 0; i < len; ++i)
-    {
-        payload[i] ^= maskKey[i % 4];
-    }
+WsOutFrame make_ws_text_frame(std::string msg)
+{
+    return make_ws_frame(WS_OPCODE_TEXT, std::move(msg));
+}
 
-    if (opcode == 0x8)
-    {
-        // close frame
-        return false;
-    }
-    if (opcode == 0x1)
+void send_ws_frame(Connection &conn, const WsOutFrame &frame)
+{
+    conn.send(frame.header, frame.payload);
+}
+
+std::size_t send_ws_text(Connection &conn, std::string msg)
+{
+    const uint64_t plainSize = msg.size();
+    std::string deflated;
+    if (conn.wsDeflate && deflate_message(msg, deflated))
     {
-        // text frame
-        outPayload = payload;
-        return true;
+        const std::size_t sent = deflated.size();
+        count_egress(1, 1, plainSize, sent);
+        send_ws_frame(conn, make_ws_frame(WS_OPCODE_TEXT, std::make_shared<const std::string>(std::move(deflated)), true));
+        return sent;
     }
-
-    // ignore other opcodes
-    return true;
+    count_egress(1, 0, plainSize, plainSize);
+    send_ws_frame(conn, make_ws_text_frame(std::move(msg)));
+    return plainSize;
 }
 
-void send_ws_text(int fd, const std::string &msg)
+WsBroadcastFrame::WsBroadcastFrame(std::string msg)
+    : plain(make_ws_text_frame(std::move(msg)))
 {
-    uint8_t header[10];
-    size_t len = msg.size();
-    size_t headerLen = 0;
+}
 
-    header[0] = 0x81; // FIN=1, opcode=1 (text)
+WsBroadcastFrame::~WsBroadcastFrame()
+{
+    if (messages > 0)
+        count_egress(messages, deflatedMessages, uncompressed_bytes(), sentBytes);
+}
 
-    if (len <= 125)
-    {
-        header[1] = static_cast<uint8_t>(len);
-        headerLen = 2;
-    }
-    else if (len < 65536)
-    {
-        header[1] = 126;
-        header[2] = (len >> 8) & 0xFF;
-        header[3] = len & 0xFF;
-        headerLen = 4;
-    }
-    else
+void WsBroadcastFrame::send(Connection &conn)
+{
+    if (conn.wsDeflate && !deflateTried)
     {
-        // large frames not supported in this minimal implementation
-        return;
+        deflateTried = true;
+        std::string out;
+        if (deflate_message(*plain.payload, out))
+            deflated = make_ws_frame(WS_OPCODE_TEXT, std::make_shared<const std::string>(std::move(out)), true);
     }
 
-    send(fd, header, headerLen, 0);
-    send(fd, msg.data(), msg.size(), 0);
-}
\ No newline at end of file
+    const WsOutFrame &frame = conn.wsDeflate && deflated.payload ? deflated : plain;
+    ++messages;
+    if (&frame == &deflated)
+        ++deflatedMessages;
+    sentBytes += frame.payload->size();
+    send_ws_frame(conn, frame);
+}
+
+WsEgressStats ws_egress_stats()
+{
+    WsEgressStats stats;
+    stats.messages = g_egressMessages.load(std::memory_order_relaxed);
+    stats.deflatedMessages = g_egressDeflated.load(std::memory_order_relaxed);
+    stats.uncompressedBytes = g_egressUncompressed.load(std::memory_order_relaxed);
+    stats.sentBytes = g_egressSent.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,167 @@
+#include "../include/ws_deflate.hpp"
+#include "../include/ws_frame.hpp"
+
+// Every message ends with this empty stored block, which goes unsent (RFC 7692 7.2.1)
+static const unsigned char DEFLATE_TAIL[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Split off the text before sep (or all of it) and advance s past it
+static std::string_view next_item(std::string_view& s, char sep)
+{
+    std::size_t pos = s.find(sep);
+    std::string_view item = s.substr(0, pos);
+    s = pos == std::string_view::npos ? std::string_view() : s.substr(pos + 1);
+    return trim(item);
+}
+
+static bool accept_offer(std::string_view offer, WsDeflateParams& params)
+{
+    if (next_item(offer, ';') != "permessage-deflate")
+        return false;
+
+    params = WsDeflateParams();
+    while (!offer.empty())
+    {
+        std::string_view param = next_item(offer, ';');
+        std::string_view name = trim(param.substr(0, param.find('=')));
+        std::string_view value;
+        if (param.find('=') != std::string_view::npos)
+            value = trim(param.substr(param.find('=') + 1));
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+
+        if (name == "server_no_context_takeover" && value.empty())
+            continue; // we never keep context anyway
+        if (name == "client_no_context_takeover" && value.empty())
+            params.clientNoContextTakeover = true;
+        else if (name == "client_max_window_bits")
+            continue; // a 15-bit inflate window decodes any smaller one
+        else if (name == "server_max_window_bits" && value == "15")
+            continue;
+        else
+            return false;
+    }
+    return true;
+}
+
+bool negotiate_permessage_deflate(std::string_view offers, WsDeflateParams& params)
+{
+    while (!offers.empty())
+    {
+        if (accept_offer(next_item(offers, ','), params))
+            return true;
+    }
+    return false;
+}
+
+std::string permessage_deflate_response(const WsDeflateParams& params)
+{
+    std::string out = "permessage-deflate; server_no_context_takeover";
+    if (params.clientNoContextTakeover)
+        out += "; client_no_context_takeover";
+    return out;
+}
+
+bool deflate_message(std::string_view msg, std::string& out)
+{
+    // deflateInit allocates a few hundred KB; keep one compressor per thread.
+    // Messages are small and start from an empty window, so memLevel 4 keeps
+    // the hash table that deflateReset clears small at almost no ratio cost.
+    struct Deflater
+    {
+        z_stream zs{};
+        bool ok;
+        Deflater() { ok = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 4, Z_DEFAULT_STRATEGY) == Z_OK; }
+        ~Deflater()
+        {
+            if (ok)
+                deflateEnd(&zs);
+        }
+    };
+    thread_local Deflater d;
+    if (!d.ok || msg.empty())
+        return false;
+
+    deflateReset(&d.zs); // no context takeover
+    out.resize(deflateBound(&d.zs, msg.size()) + 16);
+    d.zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(msg.data()));
+    d.zs.avail_in = static_cast<uInt>(msg.size());
+    d.zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    d.zs.avail_out = static_cast<uInt>(out.size());
+    if (deflate(&d.zs, Z_SYNC_FLUSH) != Z_OK || d.zs.avail_in != 0 || d.zs.avail_out == 0)
+        return false;
+
+    std::size_t n = out.size() - d.zs.avail_out;
+    if (n < 4 || n - 4 >= msg.size())
+        return false;
+    out.resize(n - 4);
+    return true;
+}
+
+WsInflater::WsInflater(bool resetEachMessage)
+    : resetEachMessage(resetEachMessage)
+{
+    ok = inflateInit2(&zs, -15) == Z_OK;
+}
+
+WsInflater::~WsInflater()
+{
+    if (ok)
+        inflateEnd(&zs);
+}
+
+bool WsInflater::inflate_message(std::string_view data, std::string& out)
+{
+    if (!ok)
+        return false;
+
+    out.clear();
+    char chunk[4096];
+    const std::string_view inputs[2] = {
+        data, std::string_view(reinterpret_cast<const char*>(DEFLATE_TAIL), sizeof(DEFLATE_TAIL))};
+    bool streamEnd = false; // the client closed the stream with a final (BFINAL) block
+    for (std::string_view in : inputs)
+    {
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        zs.avail_in = static_cast<uInt>(in.size());
+        do
+        {
+            zs.next_out = reinterpret_cast<Bytef*>(chunk);
+            zs.avail_out = sizeof(chunk);
+            int rc = inflate(&zs, Z_SYNC_FLUSH);
+            if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END)
+                return false;
+            out.append(chunk, sizeof(chunk) - zs.avail_out);
+            if (out.size() > MAX_WS_MESSAGE_BYTES)
+                return false;
+            if (rc == Z_STREAM_END)
+            {
+                streamEnd = true;
+                break;
+            }
+            if (rc == Z_BUF_ERROR)
+                break; // no progress possible: input used up
+        } while (zs.avail_in > 0 || zs.avail_out == 0);
+
+        if (streamEnd)
+        {
+            // allowed by RFC 7692; the appended tail is not needed, but message bytes past the end are bogus
+            if (in.data() == data.data() && zs.avail_in > 0)
+                return false;
+            break;
+        }
+    }
+
+    // a finished stream cannot take more input, so the next message starts a new one
+    if (resetEachMessage || streamEnd)
+        inflateReset(&zs);
+    return true;
+}
@@ -0,0 +1,134 @@
+#include "../include/ws_frame.hpp"
+
+#include <cstring>
+
+void ws_unmask(char* data, std::size_t len, const uint8_t key[4])
+{
+    // payload offsets of every 8-byte block are multiples of 4, so one
+    // doubled key lines up with all of them
+    uint64_t key64;
+    std::memcpy(&key64, key, 4);
+    std::memcpy(reinterpret_cast<char*>(&key64) + 4, key, 4);
+
+    std::size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        word ^= key64;
+        std::memcpy(data + i, &word, 8);
+    }
+    for (; i < len; ++i)
+    {
+        data[i] = static_cast<char>(data[i] ^ key[i & 3]);
+    }
+}
+
+WsFrameStatus parse_ws_frame(char* data, std::size_t len, std::size_t& consumed, WsFrame& frame)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    if (len < 2)
+        return WsFrameStatus::Incomplete;
+
+    frame.fin = (p[0] & 0x80) != 0;
+    frame.compressed = (p[0] & 0x40) != 0;
+    frame.opcode = p[0] & 0x0F;
+    if ((p[0] & 0x30) != 0 || (p[1] & 0x80) == 0)
+    {
+        // only RSV1 has a meaning (permessage-deflate), and client frames MUST be masked
+        return WsFrameStatus::Error;
+    }
+
+    const bool control = (frame.opcode & 0x8) != 0;
+    if (frame.opcode > WS_OPCODE_PONG || (frame.opcode > WS_OPCODE_BINARY && !control))
+        return WsFrameStatus::Error;
+    // RSV1 marks a whole message, so it only appears on its first data frame
+    if (frame.compressed && (control || frame.opcode == WS_OPCODE_CONTINUATION))
+        return WsFrameStatus::Error;
+
+    uint64_t payloadLen = p[1] & 0x7F;
+    std::size_t pos = 2;
+    if (payloadLen == 126)
+    {
+        if (len < 4)
+            return WsFrameStatus::Incomplete;
+        payloadLen = (uint64_t(p[2]) << 8) | p[3];
+        pos = 4;
+    }
+    else if (payloadLen == 127)
+    {
+        if (len < 10)
+            return WsFrameStatus::Incomplete;
+        payloadLen = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            payloadLen = (payloadLen << 8) | p[2 + i];
+        }
+        pos = 10;
+    }
+
+    // control frames are never fragmented and carry at most 125 bytes
+    if (control && (!frame.fin || payloadLen > 125))
+        return WsFrameStatus::Error;
+    if (payloadLen > MAX_WS_MESSAGE_BYTES)
+        return WsFrameStatus::Error;
+    if (len - pos < 4 + payloadLen)
+        return WsFrameStatus::Incomplete;
+
+    const uint8_t* maskKey = p + pos;
+    pos += 4;
+    ws_unmask(data + pos, payloadLen, maskKey);
+
+    frame.payload = std::string_view(data + pos, payloadLen);
+    consumed = pos + payloadLen;
+    return WsFrameStatus::Frame;
+}
+
+WsMessageAssembler::Result WsMessageAssembler::feed(const WsFrame& frame, uint8_t& opcode, std::string_view& payload)
+{
+    if (frame.opcode & 0x8)
+    {
+        opcode = frame.opcode;
+        payload = frame.payload;
+        return Result::Control;
+    }
+    if (!inMessage)
+    {
+        fragments.clear(); // the previous message has been handled
+    }
+
+    if (frame.opcode == WS_OPCODE_CONTINUATION)
+    {
+        if (!inMessage)
+            return Result::Error;
+    }
+    else
+    {
+        if (inMessage)
+        {
+            return Result::Error; // a new message before the last one finished
+        }
+        if (frame.fin)
+        {
+            // unfragmented: hand out the frame bytes without copying
+            messageCompressed = frame.compressed;
+            opcode = frame.opcode;
+            payload = frame.payload;
+            return Result::Message;
+        }
+        inMessage = true;
+        messageOpcode = frame.opcode;
+        messageCompressed = frame.compressed;
+    }
+
+    if (fragments.size() + frame.payload.size() > MAX_WS_MESSAGE_BYTES)
+        return Result::Error;
+    fragments.append(frame.payload);
+    if (!frame.fin)
+        return Result::Pending;
+
+    inMessage = false;
+    opcode = messageOpcode;
+    payload = fragments;
+    return Result::Message;
+}
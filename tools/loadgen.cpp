@@ -0,0 +1,643 @@
+#include "../include/ws_frame.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+Closed-loop load generator. Creates matches, claims both captains, attaches
+spectators to each over /ws, then plays every match's full veto through
+/match/action from a pool of worker threads, one keep-alive connection
+each. For every action it records the HTTP round trip and the time until
+the last spectator of that match has received the resulting patch.
+
+Usage: loadgen [--host 127.0.0.1] [--port 8080] [--matches 100]
+               [--spectators 10] [--series bo1|bo3|mix] [--threads 4]
+               [--rate 0]          total actions per second, 0 = as fast as possible */
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::size_t matches = 100;
+    std::size_t spectators = 10;
+    std::string series = "mix";
+    std::size_t threads = 4;
+    double rate = 0;
+};
+
+struct Step
+{
+    int action; // 0 ban, 1 pick, 2 side
+    int team;
+};
+
+struct LoadMatch
+{
+    std::string id;
+    std::string series;
+    std::string tokens[2];
+    std::vector<Step> steps;
+    std::vector<int> mapIds;
+
+    // the patch being waited for, filled in by the spectator readers
+    std::mutex mutex;
+    std::condition_variable delivered;
+    std::uint64_t waitingVersion = 0;
+    std::size_t received = 0;
+    Clock::time_point lastArrival;
+};
+
+struct Spectator
+{
+    LoadMatch *match;
+    int fd;
+    std::string buf;
+};
+
+static std::atomic<std::size_t> g_errors{0};
+
+static bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        const char *value = argv[++i];
+        if (arg == "--host")
+            opt.host = value;
+        else if (arg == "--port")
+            opt.port = std::atoi(value);
+        else if (arg == "--matches")
+            opt.matches = std::strtoul(value, nullptr, 10);
+        else if (arg == "--spectators")
+            opt.spectators = std::strtoul(value, nullptr, 10);
+        else if (arg == "--series")
+            opt.series = value;
+        else if (arg == "--threads")
+            opt.threads = std::max<std::size_t>(1, std::strtoul(value, nullptr, 10));
+        else if (arg == "--rate")
+            opt.rate = std::atof(value);
+        else
+            return false;
+    }
+    return opt.matches > 0 && (opt.series == "bo1" || opt.series == "bo3" || opt.series == "mix");
+}
+
+static int connect_to(const Options &opt)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(opt.port));
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// sent, if given, is set to how much of data went out, even on failure
+static bool write_all(int fd, const std::string &data, std::size_t *sent = nullptr)
+{
+    std::size_t off = 0;
+    bool ok = true;
+    while (off < data.size())
+    {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            ok = false;
+            break;
+        }
+        off += static_cast<std::size_t>(n);
+    }
+    if (sent)
+        *sent = off;
+    return ok;
+}
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                              { return std::tolower(static_cast<unsigned char>(x)) ==
+                                                       std::tolower(static_cast<unsigned char>(y)); });
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// True if the header value, a comma separated list, holds token in any case
+static bool has_token(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        std::size_t comma = value.find(',');
+        if (iequals(trim(value.substr(0, comma)), token))
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// A keep-alive HTTP/1.1 connection that reconnects when the server closes it
+class HttpClient
+{
+public:
+    explicit HttpClient(const Options &opt) : opt(opt) {}
+    ~HttpClient()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    /*
+    GET target; the status code, or 0 if the server could not be reached or
+    the response was lost. A request is only retried if none of it was sent:
+    once the server may have seen it (an action, say) it is not sent again. */
+    int get(const std::string &target, std::string &body)
+    {
+        if (fd >= 0 && peer_closed())
+            disconnect(); // closed between requests (idle timeout, request limit)
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            if (fd < 0 && (fd = connect_to(opt)) < 0)
+                return 0;
+            int status = 0;
+            std::size_t sent = 0;
+            if (write_all(fd, "GET " + target + " HTTP/1.1\r\nHost: loadgen\r\nConnection: keep-alive\r\n\r\n", &sent) &&
+                read_response(status, body))
+                return status;
+            disconnect();
+            if (sent > 0)
+                return 0;
+        }
+        return 0;
+    }
+
+private:
+    // The server has closed its end (or sent something unasked for) since the last response
+    bool peer_closed() const
+    {
+        char c;
+        ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+
+    void disconnect()
+    {
+        close(fd);
+        fd = -1;
+        buf.clear();
+    }
+
+    bool read_response(int &status, std::string &body)
+    {
+        std::size_t headEnd;
+        while ((headEnd = buf.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (!fill())
+                return false;
+        }
+        status = std::atoi(buf.c_str() + 9);
+        std::size_t length = 0;
+        bool keepAlive = true;
+        // header names and the close token are case-insensitive
+        std::string_view head(buf.data(), headEnd);
+        std::size_t lineStart = head.find("\r\n");
+        while (lineStart != std::string_view::npos)
+        {
+            lineStart += 2;
+            std::size_t lineEnd = head.find("\r\n", lineStart);
+            std::string_view line = head.substr(lineStart, lineEnd == std::string_view::npos ? std::string_view::npos : lineEnd - lineStart);
+            std::size_t colon = line.find(':');
+            if (colon != std::string_view::npos)
+            {
+                std::string_view name = trim(line.substr(0, colon));
+                std::string_view value = trim(line.substr(colon + 1));
+                if (iequals(name, "Content-Length"))
+                    length = std::strtoul(std::string(value).c_str(), nullptr, 10);
+                else if (iequals(name, "Connection") && has_token(value, "close"))
+                    keepAlive = false;
+            }
+            lineStart = lineEnd;
+        }
+
+        while (buf.size() < headEnd + 4 + length)
+        {
+            if (!fill())
+                return false;
+        }
+        body.assign(buf, headEnd + 4, length);
+        buf.erase(0, headEnd + 4 + length);
+        if (!keepAlive)
+            disconnect();
+        return true;
+    }
+
+    bool fill()
+    {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        buf.append(chunk, static_cast<std::size_t>(n));
+        return true;
+    }
+
+    const Options &opt;
+    int fd = -1;
+    std::string buf;
+};
+
+// Value of "key": in a JSON body, as text up to the next delimiter
+static std::string json_field(const std::string &body, const std::string &key, std::size_t from = 0)
+{
+    std::size_t pos = body.find("\"" + key + "\":", from);
+    if (pos == std::string::npos)
+        return "";
+    pos += key.size() + 3;
+    if (pos < body.size() && body[pos] == '"')
+    {
+        std::size_t end = body.find('"', pos + 1);
+        return body.substr(pos + 1, end - pos - 1);
+    }
+    std::size_t end = body.find_first_of(",}]", pos);
+    return body.substr(pos, end - pos);
+}
+
+// Read steps and the map pool out of a /match/state body
+static bool parse_state(const std::string &body, LoadMatch &m)
+{
+    std::size_t pos = body.find("\"steps\":[");
+    while (pos != std::string::npos)
+    {
+        pos = body.find("{\"action\":", pos);
+        if (pos == std::string::npos)
+            break;
+        Step step;
+        step.action = std::atoi(json_field(body, "action", pos).c_str());
+        step.team = std::atoi(json_field(body, "teamIndex", pos).c_str());
+        m.steps.push_back(step);
+        ++pos;
+    }
+    pos = body.find("\"availableMaps\":[");
+    while (pos != std::string::npos)
+    {
+        pos = body.find("{\"id\":", pos);
+        if (pos == std::string::npos)
+            break;
+        m.mapIds.push_back(std::atoi(body.c_str() + pos + 6));
+        ++pos;
+    }
+    return !m.steps.empty() && !m.mapIds.empty();
+}
+
+static bool setup_match(HttpClient &http, std::size_t index, const Options &opt, LoadMatch &m)
+{
+    m.series = opt.series == "mix" ? (index % 2 ? "bo3" : "bo1") : opt.series;
+    std::string body;
+    if (http.get("/match/create?teamA=Alpha&teamB=Beta&series=" + m.series, body) != 200)
+        return false;
+    m.id = json_field(body, "matchId");
+    for (int team = 0; team < 2; ++team)
+    {
+        if (http.get("/match/join?id=" + m.id + "&team=" + std::to_string(team), body) != 200)
+            return false;
+        m.tokens[team] = json_field(body, "token");
+    }
+    return http.get("/match/state?id=" + m.id, body) == 200 && parse_state(body, m);
+}
+
+// A client frame; the all-zero masking key leaves the payload as is
+static std::string masked_frame(uint8_t opcode, const std::string &payload)
+{
+    std::string frame;
+    frame.push_back(static_cast<char>(0x80 | opcode));
+    frame.push_back(static_cast<char>(0x80 | payload.size())); // ids and pings stay under 126 bytes
+    frame.append(4, '\0');
+    frame += payload;
+    return frame;
+}
+
+// Upgrade, subscribe to the match and consume its snapshot
+static int open_spectator(const Options &opt, const LoadMatch &m)
+{
+    int fd = connect_to(opt);
+    if (fd < 0)
+        return -1;
+    std::string hs = "GET /ws HTTP/1.1\r\nHost: loadgen\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: bG9hZGdlbi1zcGVjdGF0b3I=\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if (!write_all(fd, hs + masked_frame(WS_OPCODE_TEXT, m.id)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    // the 101 response, then the snapshot frame
+    std::string buf;
+    char chunk[16384];
+    while (true)
+    {
+        std::size_t headEnd = buf.find("\r\n\r\n");
+        if (headEnd != std::string::npos && buf.size() >= headEnd + 4 + 4)
+        {
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(buf.data() + headEnd + 4);
+            std::size_t len = p[1] & 0x7F, hdr = 2;
+            if (len == 126)
+                len = (std::size_t(p[2]) << 8) | p[3], hdr = 4;
+            if (buf.size() >= headEnd + 4 + hdr + len)
+                return fd;
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        buf.append(chunk, static_cast<std::size_t>(n));
+    }
+}
+
+static void on_patch(LoadMatch &m, std::uint64_t version, std::size_t spectators)
+{
+    std::lock_guard<std::mutex> lock(m.mutex);
+    if (version != m.waitingVersion)
+        return;
+    m.lastArrival = Clock::now();
+    if (++m.received == spectators)
+        m.delivered.notify_one();
+}
+
+static const std::string PATCH_PREFIX = "{\"type\":\"patch\"";
+
+// Read patches off every spectator socket handed to this epoll instance
+static void spectator_reader(int epollFd, std::size_t spectators, const std::atomic<bool> &stop)
+{
+    epoll_event events[256];
+    char chunk[65536];
+    while (!stop.load())
+    {
+        int n = epoll_wait(epollFd, events, 256, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            Spectator &s = *static_cast<Spectator *>(events[i].data.ptr);
+            ssize_t got;
+            while ((got = recv(s.fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0)
+                s.buf.append(chunk, static_cast<std::size_t>(got));
+
+            // server frames are unmasked and never fragmented
+            std::size_t off = 0;
+            while (s.buf.size() - off >= 2)
+            {
+                const unsigned char *p = reinterpret_cast<const unsigned char *>(s.buf.data() + off);
+                std::uint64_t len = p[1] & 0x7F;
+                std::size_t hdr = 2;
+                if (len == 126)
+                {
+                    if (s.buf.size() - off < 4)
+                        break;
+                    len = (std::uint64_t(p[2]) << 8) | p[3];
+                    hdr = 4;
+                }
+                else if (len == 127)
+                {
+                    if (s.buf.size() - off < 10)
+                        break;
+                    len = 0;
+                    for (int b = 0; b < 8; ++b)
+                        len = (len << 8) | p[2 + b];
+                    hdr = 10;
+                }
+                if (s.buf.size() - off < hdr + len)
+                    break;
+                std::string payload = s.buf.substr(off + hdr, len);
+                off += hdr + len;
+                const uint8_t opcode = p[0] & 0x0F;
+                if (opcode == WS_OPCODE_TEXT && payload.compare(0, PATCH_PREFIX.size(), PATCH_PREFIX) == 0)
+                    on_patch(*s.match, std::strtoull(json_field(payload, "version").c_str(), nullptr, 10), spectators);
+                else if (opcode == WS_OPCODE_PING)
+                    write_all(s.fd, masked_frame(WS_OPCODE_PONG, payload)); // stay clear of the heartbeat reaper
+            }
+            s.buf.erase(0, off);
+        }
+    }
+}
+
+struct WorkerResult
+{
+    std::vector<double> actionUs;
+    std::vector<double> deliveryUs;
+};
+
+// Play the full veto of every match assigned to this worker
+static void run_worker(const Options &opt, std::vector<LoadMatch *> matches, double rate, WorkerResult &out)
+{
+    HttpClient http(opt);
+    std::string body;
+    const auto interval = rate > 0 ? std::chrono::duration<double>(1.0 / rate) : std::chrono::duration<double>(0);
+    auto next = Clock::now();
+
+    for (LoadMatch *m : matches)
+    {
+        std::size_t nextMap = 0;
+        for (std::size_t i = 0; i < m->steps.size(); ++i)
+        {
+            const Step &step = m->steps[i];
+            static const char *const ACTIONS[] = {"ban", "pick", "side"};
+            int value = step.action == 2 ? 0 : m->mapIds[nextMap++ % m->mapIds.size()];
+            std::string target = "/match/action?id=" + m->id + "&team=" + std::to_string(step.team) +
+                                 "&action=" + ACTIONS[step.action] + "&map=" + std::to_string(value) +
+                                 "&token=" + m->tokens[step.team];
+
+            if (rate > 0)
+            {
+                std::this_thread::sleep_until(next);
+                next += std::chrono::duration_cast<Clock::duration>(interval);
+            }
+            {
+                std::lock_guard<std::mutex> lock(m->mutex);
+                m->waitingVersion = i + 1;
+                m->received = 0;
+            }
+
+            auto start = Clock::now();
+            int status = http.get(target, body);
+            auto answered = Clock::now();
+            if (status != 200)
+            {
+                ++g_errors;
+                break; // the rest of this veto would be rejected too
+            }
+            out.actionUs.push_back(std::chrono::duration<double, std::micro>(answered - start).count());
+
+            if (opt.spectators == 0)
+                continue;
+            std::unique_lock<std::mutex> lock(m->mutex);
+            if (!m->delivered.wait_for(lock, std::chrono::seconds(5), [&]
+                                       { return m->received == opt.spectators; }))
+            {
+                ++g_errors;
+                continue;
+            }
+            out.deliveryUs.push_back(std::chrono::duration<double, std::micro>(m->lastArrival - start).count());
+        }
+    }
+}
+
+static void print_latency(const char *label, std::vector<double> &us)
+{
+    if (us.empty())
+    {
+        std::printf("%-22s no samples\n", label);
+        return;
+    }
+    std::sort(us.begin(), us.end());
+    auto pct = [&](double p)
+    { return us[std::min(us.size() - 1, static_cast<std::size_t>(p * static_cast<double>(us.size())))]; };
+    std::printf("%-22s p50 %8.0f us   p99 %8.0f us   p999 %8.0f us   max %8.0f us   (%zu samples)\n",
+                label, pct(0.50), pct(0.99), pct(0.999), us.back(), us.size());
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt))
+    {
+        std::fprintf(stderr, "usage: %s [--host H] [--port P] [--matches N] [--spectators M]\n"
+                             "          [--series bo1|bo3|mix] [--threads T] [--rate actions/s]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    // every spectator is a socket; ask for as many descriptors as allowed
+    rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+        if (opt.matches * opt.spectators + 64 > lim.rlim_cur)
+            std::fprintf(stderr, "warning: %zu spectators exceed the %llu file descriptor limit\n",
+                         opt.matches * opt.spectators, static_cast<unsigned long long>(lim.rlim_cur));
+    }
+
+    std::vector<std::unique_ptr<LoadMatch>> matches;
+    auto setupStart = Clock::now();
+    {
+        HttpClient http(opt);
+        for (std::size_t i = 0; i < opt.matches; ++i)
+        {
+            auto m = std::make_unique<LoadMatch>();
+            if (!setup_match(http, i, opt, *m))
+            {
+                std::fprintf(stderr, "could not set up match %zu on %s:%d\n", i, opt.host.c_str(), opt.port);
+                return 1;
+            }
+            matches.push_back(std::move(m));
+        }
+    }
+
+    const std::size_t readerCount = std::min<std::size_t>(4, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<int> epollFds;
+    for (std::size_t i = 0; i < readerCount; ++i)
+        epollFds.push_back(epoll_create1(EPOLL_CLOEXEC));
+    std::vector<std::unique_ptr<Spectator>> spectators;
+    for (auto &m : matches)
+    {
+        for (std::size_t s = 0; s < opt.spectators; ++s)
+        {
+            int fd = open_spectator(opt, *m);
+            if (fd < 0)
+            {
+                std::fprintf(stderr, "could not attach spectator %zu of match %s\n", s, m->id.c_str());
+                return 1;
+            }
+            spectators.push_back(std::make_unique<Spectator>(Spectator{m.get(), fd, std::string()}));
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.ptr = spectators.back().get();
+            epoll_ctl(epollFds[spectators.size() % readerCount], EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+    double setupSec = std::chrono::duration<double>(Clock::now() - setupStart).count();
+    std::printf("set up %zu matches (%s) with %zu spectators each in %.2f s\n",
+                matches.size(), opt.series.c_str(), opt.spectators, setupSec);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int epollFd : epollFds)
+        readers.emplace_back(spectator_reader, epollFd, opt.spectators, std::cref(stop));
+
+    // matches are dealt round-robin to workers, each with an equal share of the rate
+    std::vector<std::vector<LoadMatch *>> shares(opt.threads);
+    for (std::size_t i = 0; i < matches.size(); ++i)
+        shares[i % opt.threads].push_back(matches[i].get());
+    std::vector<WorkerResult> results(opt.threads);
+    std::vector<std::thread> workers;
+    auto runStart = Clock::now();
+    for (std::size_t t = 0; t < opt.threads; ++t)
+        workers.emplace_back(run_worker, std::cref(opt), shares[t], opt.rate / static_cast<double>(opt.threads),
+                             std::ref(results[t]));
+    for (auto &w : workers)
+        w.join();
+    double runSec = std::chrono::duration<double>(Clock::now() - runStart).count();
+
+    stop = true;
+    for (auto &r : readers)
+        r.join();
+    for (auto &s : spectators)
+        close(s->fd);
+    for (int epollFd : epollFds)
+        close(epollFd);
+
+    WorkerResult all;
+    for (auto &r : results)
+    {
+        all.actionUs.insert(all.actionUs.end(), r.actionUs.begin(), r.actionUs.end());
+        all.deliveryUs.insert(all.deliveryUs.end(), r.deliveryUs.begin(), r.deliveryUs.end());
+    }
+    std::printf("%zu actions in %.2f s (%.0f actions/s, %zu threads), %zu errors\n",
+                all.actionUs.size(), runSec, static_cast<double>(all.actionUs.size()) / runSec,
+                opt.threads, g_errors.load());
+    print_latency("action round trip", all.actionUs);
+    if (opt.spectators > 0)
+        print_latency("delivered to last", all.deliveryUs);
+    return g_errors.load() == 0 ? 0 : 1;
+}
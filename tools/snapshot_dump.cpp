@@ -0,0 +1,89 @@
+#include "../include/snapshot.hpp"
+
+#include <cstdio>
+#include <string>
+
+/*
+Print the contents of a match store snapshot without a running server.
+Captain tokens are not printed, only whether each team has claimed one.
+
+Usage: snapshot_dump <snapshot.bin> [matchId] */
+
+using namespace pb;
+
+static void print_ints(const char *label, const std::vector<int> &values)
+{
+    std::printf("  %-14s [", label);
+    for (std::size_t i = 0; i < values.size(); ++i)
+        std::printf(i ? ",%d" : "%d", values[i]);
+    std::printf("]\n");
+}
+
+static void print_record(const SnapshotView &view, const SnapshotMatch &rec)
+{
+    bool ok = true;
+    std::string id(view.id(rec));
+    std::string format(view.string(rec.format, ok));
+    std::printf("%s  format=%s phase=%u step=%u turn=%d version=%llu\n",
+                id.c_str(), format.c_str(), rec.phase, rec.currentStepIndex, rec.currentTurnTeam,
+                static_cast<unsigned long long>(rec.version));
+
+    for (int t = 0; t < 2; ++t)
+    {
+        std::string name(view.string(rec.teamNames[t], ok));
+        std::printf("  team %d         \"%s\" captain=%s\n", t, name.c_str(),
+                    rec.captainTokens[t].length ? "claimed" : "open");
+        print_ints(t ? "  banned (B)" : "  banned (A)", view.ints(rec.bannedMapIds[t], ok));
+        print_ints(t ? "  picked (B)" : "  picked (A)", view.ints(rec.pickedMapIds[t], ok));
+    }
+    std::printf("  decider        map=%d side=%d picker=%d\n",
+                rec.deciderMapId, rec.deciderSide, rec.deciderSidePickerTeam);
+    print_ints("stepMapIds", view.ints(rec.stepMapIds, ok));
+    print_ints("stepSideVals", view.ints(rec.stepSideVals, ok));
+
+    SnapshotRef sides = rec.mapSides;
+    sides.length *= 2;
+    print_ints("mapSides", view.ints(sides, ok));
+
+    if (!ok)
+        std::printf("  (record refers outside the blob)\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::fprintf(stderr, "usage: %s <snapshot.bin> [matchId]\n", argv[0]);
+        return 2;
+    }
+
+    std::string error;
+    auto view = SnapshotView::open(argv[1], error);
+    if (!view)
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    const SnapshotHeader &h = view->header();
+    std::printf("snapshot v%u: %llu matches, journal generation %llu, %llu blob bytes\n",
+                h.version, static_cast<unsigned long long>(h.matchCount),
+                static_cast<unsigned long long>(h.journalGeneration),
+                static_cast<unsigned long long>(h.blobSize));
+
+    if (argc == 3)
+    {
+        std::ptrdiff_t i = view->find(argv[2]);
+        if (i < 0)
+        {
+            std::fprintf(stderr, "%s: no such match\n", argv[2]);
+            return 1;
+        }
+        print_record(*view, view->record(static_cast<std::size_t>(i)));
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < view->size(); ++i)
+        print_record(*view, view->record(i));
+    return 0;
+}